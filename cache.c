@@ -0,0 +1,439 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, track cache.
+ *
+ */
+
+/**
+ * @file cache.c Track cache implementation.
+ *
+ * Entries live in a hash table keyed by device and inode and in a list
+ * ordered by last use. Loads run without the lock held; requests for
+ * an entry being loaded wait on the cache condition variable.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "track_priv.h"
+
+
+#define CACHE_MIN_BUCKETS 64
+#define CACHE_HASH_MULT   0x9e3779b97f4a7c15ULL
+
+
+enum cache_state {
+    CACHE_LOADING,
+    CACHE_READY,
+    CACHE_FAILED,
+};
+
+struct cache_entry {
+    dev_t                dev;
+    ino_t                ino;
+    off_t                size;
+    int64_t              mtime;
+
+    track_t              track;
+    size_t               bytes;
+    unsigned             refs;
+    enum cache_state     state;
+
+    /* in the table and the list; unlinked entries are freed on last release */
+    int                  linked;
+    struct cache_entry * next;
+    struct cache_entry * lru_prev;
+    struct cache_entry * lru_next;
+};
+
+struct cache_o {
+    log_hndl                err_hndl;
+    trk_setup_hndl          setup;
+    void                  * env;
+    size_t                  budget;
+
+    pthread_mutex_t         lock;
+    pthread_cond_t          loaded;
+
+    struct cache_entry   ** buckets;
+    size_t                  nbuckets;
+
+    /* most recently used first */
+    struct cache_entry    * lru_head;
+    struct cache_entry    * lru_tail;
+
+    struct trk_cache_stats  stats;
+};
+
+
+static struct cache_entry * trk_cache_find( trk_cache_t cache, dev_t dev, ino_t ino );
+static int trk_cache_link( trk_cache_t cache, struct cache_entry * entry );
+static void trk_cache_unlink( trk_cache_t cache, struct cache_entry * entry );
+static void trk_cache_touch( trk_cache_t cache, struct cache_entry * entry );
+static void trk_cache_evict( trk_cache_t cache );
+static void trk_cache_put( trk_cache_t cache, struct cache_entry * entry );
+static void trk_cache_free( struct cache_entry * entry );
+static size_t trk_cache_bucket( dev_t dev, ino_t ino, size_t nbuckets );
+static void trk_cache_error( trk_cache_t cache, const char * fmt, ... )
+    __attribute__ ((format(printf, 2, 3)));
+
+
+
+TU_EXPORT trk_cache_t trk_cache_make( log_hndl         err_hndl,
+				      trk_setup_hndl   setup,
+				      void           * env,
+				      size_t           budget )
+{
+    trk_cache_t cache;
+
+    trk_global_init();
+
+    cache = calloc( 1, sizeof( *cache ) );
+    if( !cache )
+	return NULL;
+
+    cache->buckets = calloc( CACHE_MIN_BUCKETS, sizeof( *cache->buckets ) );
+    if( !cache->buckets ) {
+	free( cache );
+	return NULL;
+    }
+    cache->nbuckets = CACHE_MIN_BUCKETS;
+
+    cache->err_hndl = err_hndl;
+    cache->setup    = setup;
+    cache->env      = env;
+    cache->budget   = budget;
+
+    pthread_mutex_init( &cache->lock, NULL );
+    pthread_cond_init( &cache->loaded, NULL );
+
+    return cache;
+}
+
+TU_EXPORT void trk_cache_drop( trk_cache_t cache )
+{
+    struct cache_entry *entry, *next;
+
+    if( !cache )
+	return;
+
+    for( entry = cache->lru_head; entry; entry = next ) {
+	next = entry->lru_next;
+	assert( entry->refs == 0 );
+	trk_cache_free( entry );
+    }
+
+    pthread_cond_destroy( &cache->loaded );
+    pthread_mutex_destroy( &cache->lock );
+
+    free( cache->buckets );
+    free( cache );
+}
+
+TU_EXPORT track_t trk_cache_get( trk_cache_t cache, const char * file )
+{
+    struct cache_entry *entry;
+    struct stat st;
+    int64_t mtime;
+    track_t track;
+    int ret;
+
+    assert( cache );
+    assert( file );
+
+    if( stat( file, &st ) ) {
+	trk_cache_error( cache, "can not stat '%s': %s", file, strerror( errno ) );
+	return NULL;
+    }
+
+    mtime = ( int64_t )st.st_mtim.tv_sec * TRK_NSEC_PER_SEC + st.st_mtim.tv_nsec;
+
+    pthread_mutex_lock( &cache->lock );
+
+    entry = trk_cache_find( cache, st.st_dev, st.st_ino );
+
+    /* the file changed since it was loaded: users keep the old track */
+    if( entry && ( entry->size != st.st_size || entry->mtime != mtime ) ) {
+	trk_cache_unlink( cache, entry );
+	if( entry->refs == 0 )
+	    trk_cache_free( entry );
+	entry = NULL;
+    }
+
+    if( entry ) {
+	entry->refs++;
+	trk_cache_touch( cache, entry );
+
+	if( entry->state == CACHE_LOADING ) {
+	    cache->stats.waits++;
+	    while( entry->state == CACHE_LOADING )
+		pthread_cond_wait( &cache->loaded, &cache->lock );
+	} else {
+	    cache->stats.hits++;
+	}
+
+	track = entry->state == CACHE_READY ? entry->track : NULL;
+	if( !track )
+	    trk_cache_put( cache, entry );
+
+	pthread_mutex_unlock( &cache->lock );
+
+	return track;
+    }
+
+    cache->stats.misses++;
+
+    entry = calloc( 1, sizeof( *entry ) );
+    if( entry ) {
+	entry->dev   = st.st_dev;
+	entry->ino   = st.st_ino;
+	entry->size  = st.st_size;
+	entry->mtime = mtime;
+	entry->refs  = 1;
+	entry->state = CACHE_LOADING;
+    }
+    if( !entry || !trk_cache_link( cache, entry ) ) {
+	pthread_mutex_unlock( &cache->lock );
+	free( entry );
+	trk_cache_error( cache, "can not cache '%s': %s", file, strerror( ENOMEM ) );
+	return NULL;
+    }
+
+    pthread_mutex_unlock( &cache->lock );
+
+    track = trk_make( cache->err_hndl, NULL, cache->env );
+    ret = track != NULL;
+    if( ret ) {
+	if( cache->setup )
+	    cache->setup( cache->env, track );
+	trk_set_cache_entry( track, entry );
+	ret = trk_from_file( track, file );
+    } else {
+	trk_cache_error( cache, "can not cache '%s': %s", file, strerror( ENOMEM ) );
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    entry->track = track;
+
+    if( ret ) {
+	entry->state = CACHE_READY;
+	entry->bytes = trk_get_memory( track );
+	if( entry->linked ) {
+	    cache->stats.bytes += entry->bytes;
+	    trk_cache_evict( cache );
+	}
+    } else {
+	entry->state = CACHE_FAILED;
+	trk_cache_unlink( cache, entry );
+	trk_cache_put( cache, entry );
+	track = NULL;
+    }
+
+    pthread_cond_broadcast( &cache->loaded );
+    pthread_mutex_unlock( &cache->lock );
+
+    return track;
+}
+
+TU_EXPORT void trk_cache_release( trk_cache_t cache, track_t track )
+{
+    struct cache_entry *entry;
+
+    assert( cache );
+
+    if( !track )
+	return;
+
+    entry = trk_get_cache_entry( track );
+    assert( entry && entry->track == track );
+
+    pthread_mutex_lock( &cache->lock );
+    trk_cache_put( cache, entry );
+    pthread_mutex_unlock( &cache->lock );
+}
+
+TU_EXPORT void trk_cache_get_stats( trk_cache_t cache, struct trk_cache_stats * stats )
+{
+    assert( cache );
+    assert( stats );
+
+    pthread_mutex_lock( &cache->lock );
+    *stats = cache->stats;
+    pthread_mutex_unlock( &cache->lock );
+}
+
+
+static struct cache_entry * trk_cache_find( trk_cache_t cache, dev_t dev, ino_t ino )
+{
+    struct cache_entry *entry;
+
+    entry = cache->buckets[trk_cache_bucket( dev, ino, cache->nbuckets )];
+    while( entry && ( entry->dev != dev || entry->ino != ino ) )
+	entry = entry->next;
+
+    return entry;
+}
+
+/*
+ * Add an entry to the table, doubling it past one entry per bucket,
+ * and to the front of the list.
+ */
+static int trk_cache_link( trk_cache_t cache, struct cache_entry * entry )
+{
+    struct cache_entry **buckets, **old, *e, *next;
+    size_t i, n, b;
+
+    if( cache->stats.entries >= cache->nbuckets ) {
+	n = cache->nbuckets * 2;
+	buckets = calloc( n, sizeof( *buckets ) );
+	if( !buckets )
+	    return 0;
+
+	old = cache->buckets;
+	cache->buckets = buckets;
+	for( i = 0; i < cache->nbuckets; i++ ) {
+	    for( e = old[i]; e; e = next ) {
+		next = e->next;
+		b = trk_cache_bucket( e->dev, e->ino, n );
+		e->next = buckets[b];
+		buckets[b] = e;
+	    }
+	}
+	cache->nbuckets = n;
+	free( old );
+    }
+
+    b = trk_cache_bucket( entry->dev, entry->ino, cache->nbuckets );
+    entry->next = cache->buckets[b];
+    cache->buckets[b] = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if( cache->lru_head )
+	cache->lru_head->lru_prev = entry;
+    else
+	cache->lru_tail = entry;
+    cache->lru_head = entry;
+
+    entry->linked = 1;
+    cache->stats.entries++;
+
+    return 1;
+}
+
+static void trk_cache_unlink( trk_cache_t cache, struct cache_entry * entry )
+{
+    struct cache_entry **p;
+
+    if( !entry->linked )
+	return;
+
+    p = &cache->buckets[trk_cache_bucket( entry->dev, entry->ino, cache->nbuckets )];
+    while( *p != entry )
+	p = &( *p )->next;
+    *p = entry->next;
+
+    if( entry->lru_prev )
+	entry->lru_prev->lru_next = entry->lru_next;
+    else
+	cache->lru_head = entry->lru_next;
+    if( entry->lru_next )
+	entry->lru_next->lru_prev = entry->lru_prev;
+    else
+	cache->lru_tail = entry->lru_prev;
+
+    entry->linked = 0;
+    cache->stats.entries--;
+    if( entry->state == CACHE_READY )
+	cache->stats.bytes -= entry->bytes;
+}
+
+static void trk_cache_touch( trk_cache_t cache, struct cache_entry * entry )
+{
+    if( cache->lru_head == entry )
+	return;
+
+    entry->lru_prev->lru_next = entry->lru_next;
+    if( entry->lru_next )
+	entry->lru_next->lru_prev = entry->lru_prev;
+    else
+	cache->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+}
+
+/*
+ * Drop least recently used tracks nobody holds until the cache fits
+ * its budget.
+ */
+static void trk_cache_evict( trk_cache_t cache )
+{
+    struct cache_entry *entry, *prev;
+
+    for( entry = cache->lru_tail;
+	 entry && cache->stats.bytes > cache->budget;
+	 entry = prev ) {
+	prev = entry->lru_prev;
+
+	if( entry->refs || entry->state != CACHE_READY )
+	    continue;
+
+	trk_cache_unlink( cache, entry );
+	trk_cache_free( entry );
+	cache->stats.evictions++;
+    }
+}
+
+static void trk_cache_put( trk_cache_t cache, struct cache_entry * entry )
+{
+    assert( entry->refs > 0 );
+
+    if( --entry->refs )
+	return;
+
+    if( !entry->linked )
+	trk_cache_free( entry );
+    else
+	trk_cache_evict( cache );
+}
+
+static void trk_cache_free( struct cache_entry * entry )
+{
+    trk_drop( entry->track );
+    free( entry );
+}
+
+static size_t trk_cache_bucket( dev_t dev, ino_t ino, size_t nbuckets )
+{
+    uint64_t h;
+
+    h = ( ( uint64_t )dev * CACHE_HASH_MULT ^ ( uint64_t )ino ) * CACHE_HASH_MULT;
+
+    return ( size_t )( h >> 32 ) & ( nbuckets - 1 );
+}
+
+static void trk_cache_error( trk_cache_t cache, const char * fmt, ... )
+{
+    char msg[4096];
+    va_list ap;
+
+    if( !cache->err_hndl )
+	return;
+
+    va_start( ap, fmt );
+    vsnprintf( msg, sizeof( msg ), fmt, ap );
+    va_end( ap );
+
+    cache->err_hndl( cache->env, msg );
+}
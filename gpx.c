@@ -6,341 +6,748 @@
 
 /**
  * @file gpx.c GPX parser implementation.
+ *
+ * Documents are first run through a scanner that works on the raw
+ * buffer and handles the plain GPX written by devices: no DOCTYPE, no
+ * CDATA, no entity references in point values. On anything else it
+ * gives up, the points it added are dropped and the document is
+ * streamed through xmlTextReader instead. Neither path builds a tree,
+ * so memory use does not depend on the document size.
  */
 
 
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <math.h>
 
+#include <libxml/xmlreader.h>
+
 #include "gpx.h"
 #include "track_priv.h"
+#include "number.h"
 
 
 //#define PARSE_GPX_WAYPOINTS
 
 
-static int trk_parse_gpx_track( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_gpx_track_segment( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_gpx_point( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_gpx_extensions( track_t       track,
-				     xmlDocPtr     doc,
-				     xmlNodePtr    node,
-				     double      * speed,
-				     double      * azimuth,
-				     const char ** address );
-static int trk_parse_gpx_trackpoint_extension( track_t      track,
-					       xmlDocPtr    doc,
-					       xmlNodePtr   node,
-					       double     * speed,
-					       double     * azimuth );
-static int trk_parse_gpx_waypoint_extension( track_t       track,
-					     xmlDocPtr     doc,
-					     xmlNodePtr    node,
-					     const char ** address );
-static int trk_parse_gpx_waypoint_address( track_t       track,
-					   xmlDocPtr     doc,
-					   xmlNodePtr    node,
-					   const char ** address );
-
-
-
-int trk_parse_gpx( track_t track, xmlDocPtr doc, xmlNodePtr node )
+#define GPX_PARSE_OPTIONS ( XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_COMPACT )
+
+/* deeper documents are left to the reader */
+#define GPX_SCAN_DEPTH 32
+
+enum gpx_field {
+    GPX_FIELD_NONE = 0,
+    GPX_FIELD_ELE,
+    GPX_FIELD_TIME,
+    GPX_FIELD_COURSE,
+    GPX_FIELD_SPEED,
+    GPX_FIELD_SAT,
+    GPX_FIELD_FIX,
+    GPX_FIELD_HDOP,
+    GPX_FIELD_VDOP,
+    GPX_FIELD_PDOP,
+};
+
+struct gpx_point {
+    int64_t  time;
+    int      valid;
+    double   latitude;
+    double   longitude;
+    double   altitude;
+    double   azimuth;
+    double   speed;
+    int      nsat;
+    int      fix_type;
+    double   hdop;
+    double   vdop;
+    double   pdop;
+};
+
+/*
+ * Point children and their TrackPointExtension counterparts
+ * (speed, course) share local names.
+ */
+static const struct {
+    const char     * name;
+    size_t           len;
+    enum gpx_field   field;
+} gpx_fields[] = {
+    { "ele",    3, GPX_FIELD_ELE    },
+    { "time",   4, GPX_FIELD_TIME   },
+    { "course", 6, GPX_FIELD_COURSE },
+    { "speed",  5, GPX_FIELD_SPEED  },
+    { "sat",    3, GPX_FIELD_SAT    },
+    { "fix",    3, GPX_FIELD_FIX    },
+    { "hdop",   4, GPX_FIELD_HDOP   },
+    { "vdop",   4, GPX_FIELD_VDOP   },
+    { "pdop",   4, GPX_FIELD_PDOP   },
+};
+
+/* qualified name of an open element, to match its end tag */
+struct gpx_tag {
+    const char * name;
+    size_t       len;
+};
+
+static const struct gpx_point gpx_point_init = {
+    .time      = 0,
+    .valid     = 1,
+    .latitude  = NAN,
+    .longitude = NAN,
+    .altitude  = NAN,
+    .azimuth   = NAN,
+    .speed     = NAN,
+    .nsat      = -1,
+    .fix_type  = -1,
+    .hdop      = NAN,
+    .vdop      = NAN,
+    .pdop      = NAN,
+};
+
+
+static size_t trk_count_gpx_points( const void * data, size_t size );
+static int trk_scan_gpx( track_t track, const char * data, size_t size );
+static int trk_scan_gpx_point( track_t                track,
+			       const char          ** pos,
+			       const char           * end,
+			       const struct gpx_tag * tag );
+static int trk_scan_end_tag( const char          ** pos,
+			     const char           * end,
+			     const struct gpx_tag * tag );
+static const char * trk_scan_find( const char * p,
+				   const char * end,
+				   const char * str,
+				   size_t       len );
+static int trk_scan_utf8( const char * decl, const char * end );
+static const char * trk_scan_name( const char ** pos,
+				   const char  * end,
+				   size_t      * len );
+static int trk_scan_attrs( const char ** pos,
+			   const char  * end,
+			   int         * empty,
+			   const char ** lat,
+			   size_t      * lat_len,
+			   const char ** lon,
+			   size_t      * lon_len );
+static int trk_scan_value( const char * value, size_t len );
+static int trk_scan_blank( const char * value, size_t len );
+static int trk_read_gpx( track_t track, const void * data, size_t size );
+static int trk_read_gpx_point( track_t track, xmlTextReaderPtr reader );
+static int trk_parse_xml_double( xmlTextReaderPtr reader, double * value );
+static int trk_is_gpx_point( const char * name, size_t len );
+static enum gpx_field trk_gpx_field( const char * name, size_t len );
+static void trk_parse_gpx_value( struct gpx_point * point,
+				 enum gpx_field     field,
+				 const char       * value,
+				 size_t             len );
+static int trk_add_gpx_point( track_t track, const struct gpx_point * point );
+
+
+
+int trk_parse_gpx( track_t track, const void * data, size_t size )
 {
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"trk" ) ) {
-	    if( !trk_parse_gpx_track( track, doc, node ) ) {
-		return 0;
-	    }
-#ifdef PARSE_GPX_WAYPOINTS
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"wpt" ) ) {
-	    if( !trk_parse_gpx_point( track, doc, node ) ) {
-		return 0;
-	    }
-#endif
-	}
-    }
+    size_t npoints;
 
-    return 1;
+    npoints = trk_get_npoints( track );
+
+    if( !trk_reserve( track, npoints + trk_count_gpx_points( data, size ) ) )
+	return 0;
+
+    if( trk_scan_gpx( track, data, size ) )
+	return 1;
+
+    trk_truncate( track, npoints );
+
+    return trk_read_gpx( track, data, size );
 }
 
-static int trk_parse_gpx_track( track_t track, xmlDocPtr doc, xmlNodePtr node )
+
+/*
+ * Upper estimate of the number of points, to presize the track.
+ */
+static size_t trk_count_gpx_points( const void * data, size_t size )
 {
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"name" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"trkseg" ) ) {
-	    if( !trk_parse_gpx_track_segment( track, doc, node ) )
-		return 0;
-	}
+    const char *p = data, *end = p + size;
+    size_t n = 0;
+
+    while( ( p = memchr( p, '<', end - p ) ) ) {
+	p++;
+	if( end - p >= 5 && !memcmp( p, "trkpt", 5 ) )
+	    n++;
     }
 
-    return 1;
+    return n;
 }
 
-static int trk_parse_gpx_track_segment( track_t track, xmlDocPtr doc, xmlNodePtr node )
+/*
+ * Fast path: convert the document straight from the buffer.
+ * Returns 0 on anything it does not handle, including malformed
+ * input; the reader then converts the document or reports the error.
+ */
+static int trk_scan_gpx( track_t track, const char * data, size_t size )
 {
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"trkpt" ) ) {
-	    if( !trk_parse_gpx_point( track, doc, node ) )
+    struct gpx_tag open[GPX_SCAN_DEPTH], tag;
+    const char *p = data, *end = data + size, *name;
+    size_t len;
+    int depth = 0, root = 0, empty;
+
+    if( size >= 3 && !memcmp( p, "\xEF\xBB\xBF", 3 ) )
+	p += 3;
+
+    while( ( p = memchr( p, '<', end - p ) ) ) {
+	if( ++p == end )
+	    return 0;
+
+	if( *p == '?' ) {
+	    name = p;
+	    p = trk_scan_find( p, end, "?>", 2 );
+	    if( !p )
+		return 0;
+	    /* encodings other than UTF-8 are left to the reader */
+	    if( !root && p - name > 4 && !memcmp( name, "?xml", 4 ) &&
+		!trk_scan_utf8( name, p ) )
+		return 0;
+	    continue;
+	}
+
+	if( *p == '!' ) {
+	    /* comments only: DOCTYPE may declare entities, CDATA may hide tags */
+	    if( end - p < 3 || memcmp( p, "!--", 3 ) )
+		return 0;
+	    p = trk_scan_find( p + 3, end, "-->", 3 );
+	    if( !p )
+		return 0;
+	    continue;
+	}
+
+	if( *p == '/' ) {
+	    p++;
+	    if( --depth < 0 || !trk_scan_end_tag( &p, end, &open[depth] ) )
+		return 0;
+	    continue;
+	}
+
+	tag.name = p;
+	name = trk_scan_name( &p, end, &len );
+	if( !name )
+	    return 0;
+	tag.len = p - tag.name;
+
+	if( depth == 0 ) {
+	    if( root || len != 3 || memcmp( name, "gpx", 3 ) )
+		return 0;
+	    root = 1;
+	}
+
+	if( trk_is_gpx_point( name, len ) ) {
+	    if( !trk_scan_gpx_point( track, &p, end, &tag ) )
 		return 0;
+	    continue;
+	}
+
+	if( !trk_scan_attrs( &p, end, &empty, NULL, NULL, NULL, NULL ) )
+	    return 0;
+	if( !empty ) {
+	    if( depth == GPX_SCAN_DEPTH )
+		return 0;
+	    open[depth++] = tag;
 	}
     }
 
-    return 1;
+    return root && depth == 0;
 }
 
-static int trk_parse_gpx_point( track_t track, xmlDocPtr doc, xmlNodePtr node )
+/*
+ * Convert a point element named tag, pos is just past its name. On
+ * success pos is left past the element end tag.
+ */
+static int trk_scan_gpx_point( track_t                track,
+			       const char          ** pos,
+			       const char           * end,
+			       const struct gpx_tag * tag )
 {
-    xmlChar *lat, *lng;
-    double latitude = NAN, longitude = NAN, altitude = NAN, azimuth = NAN, speed = NAN;
-    time_t time = 0;
-    int nsat = -1, fix_type = -1;
-    double hdop = NAN, vdop = NAN, pdop = NAN;
-
-    lat = xmlGetProp( node, ( const xmlChar * )"lat" );
-    if( !lat )
-	return 1;
+    struct gpx_point point = gpx_point_init;
+    struct gpx_tag open[GPX_SCAN_DEPTH];
+    const char *p, *name, *lat = NULL, *lon = NULL;
+    size_t len, lat_len = 0, lon_len = 0;
+    enum gpx_field field;
+    int depth = 1, empty;
+
+    open[0] = *tag;
+
+    if( !trk_scan_attrs( pos, end, &empty, &lat, &lat_len, &lon, &lon_len ) )
+	return 0;
+
+    if( lat && lon ) {
+	if( !trk_scan_value( lat, lat_len ) || !trk_scan_value( lon, lon_len ) )
+	    return 0;
+	if( !trk_parse_double( lat, lat_len, &point.latitude ) ||
+	    !trk_parse_double( lon, lon_len, &point.longitude ) )
+	    point.valid = 0;
+    } else {
+	point.valid = 0;
+    }
 
-    latitude = atof( ( const char * )lat );
-    xmlFree( lat );
+    for( p = *pos; !empty; ) {
+	p = memchr( p, '<', end - p );
+	if( !p || ++p == end )
+	    return 0;
 
-    lng = xmlGetProp( node, ( const xmlChar * )"lon" );
-    if( !lng )
-	return 1;
+	if( *p == '?' ) {
+	    p = trk_scan_find( p, end, "?>", 2 );
+	    if( !p )
+		return 0;
+	    continue;
+	}
 
-    longitude = atof( ( const char * )lng );
-    xmlFree( lng );
+	if( *p == '!' ) {
+	    if( end - p < 3 || memcmp( p, "!--", 3 ) )
+		return 0;
+	    p = trk_scan_find( p + 3, end, "-->", 3 );
+	    if( !p )
+		return 0;
+	    continue;
+	}
 
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"ele" ) ) {
-	    xmlChar *val;
+	if( *p == '/' ) {
+	    p++;
+	    if( !trk_scan_end_tag( &p, end, &open[--depth] ) )
+		return 0;
+	    if( depth == 0 )
+		break;
+	    continue;
+	}
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    altitude = atof( ( const char * )val );
+	if( depth == GPX_SCAN_DEPTH )
+	    return 0;
+	open[depth].name = p;
+	name = trk_scan_name( &p, end, &len );
+	if( !name )
+	    return 0;
+	open[depth].len = p - open[depth].name;
+	if( !trk_scan_attrs( &p, end, &empty, NULL, NULL, NULL, NULL ) )
+	    return 0;
+
+	if( empty ) {
+	    empty = 0;
+	    continue;
+	}
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"time" ) ) {
-	    xmlChar *val;
-	    struct tm tm;
+	depth++;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
+	field = trk_gpx_field( name, len );
+	if( field != GPX_FIELD_NONE ) {
+	    const char *value = p;
 
-	    strptime( ( const char * )val, "%FT%TZ", &tm );
-	    tm.tm_isdst = -1;
-	    time = mktime( &tm );
+	    /* the value must be a single text node ended by an end tag */
+	    p = memchr( p, '<', end - p );
+	    if( !p || end - p < 2 || p[1] != '/' )
+		return 0;
+	    if( !trk_scan_value( value, p - value ) )
+		return 0;
+	    /* blank values are dropped, as the reader does */
+	    if( !trk_scan_blank( value, p - value ) )
+		trk_parse_gpx_value( &point, field, value, p - value );
+	}
+    }
 
-	    xmlFree( val );
+    *pos = p;
 
-	    if( time == -1 )
-		return 1;
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"course" ) ) {
-	    xmlChar *val;
+    if( !point.valid )
+	return 1;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    azimuth = atof( ( const char * )val );
+    return trk_add_gpx_point( track, &point );
+}
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"speed" ) ) {
-	    xmlChar *val;
+/*
+ * Check an end tag against the open element, pos is just past its
+ * slash. On success pos is left past the tag.
+ */
+static int trk_scan_end_tag( const char          ** pos,
+			     const char           * end,
+			     const struct gpx_tag * tag )
+{
+    const char *p = *pos;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    speed = atof( ( const char * )val );
+    if( ( size_t )( end - p ) <= tag->len || memcmp( p, tag->name, tag->len ) )
+	return 0;
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"sat" ) ) {
-	    xmlChar *val;
+    for( p += tag->len; p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ); p++ )
+	;
+    if( p == end || *p != '>' )
+	return 0;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    nsat = atoi( ( const char * )val );
+    *pos = p + 1;
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"fix" ) ) {
-	    xmlChar *val;
+    return 1;
+}
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    if( !xmlStrcmp( node->name, ( const xmlChar * )"2D" ) )
-		fix_type = 2;
-	    else if( !xmlStrcmp( node->name, ( const xmlChar * )"3D" ) )
-		fix_type = 3;
+static const char * trk_scan_find( const char * p,
+				   const char * end,
+				   const char * str,
+				   size_t       len )
+{
+    while( ( p = memchr( p, str[0], end - p ) ) ) {
+	if( ( size_t )( end - p ) < len )
+	    return NULL;
+	if( !memcmp( p, str, len ) )
+	    return p + len;
+	p++;
+    }
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"hdop" ) ) {
-	    xmlChar *val;
+    return NULL;
+}
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    hdop = atof( ( const char * )val );
+/*
+ * Check the encoding named by an XML declaration.
+ */
+static int trk_scan_utf8( const char * decl, const char * end )
+{
+    const char *p, *value;
+    size_t len;
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"vdop" ) ) {
-	    xmlChar *val;
+    p = trk_scan_find( decl, end, "encoding", 8 );
+    if( !p )
+	return 1;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    vdop = atof( ( const char * )val );
+    while( p < end && *p != '"' && *p != '\'' )
+	p++;
+    if( p == end )
+	return 0;
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"pdop" ) ) {
-	    xmlChar *val;
+    value = p + 1;
+    p = memchr( value, *p, end - value );
+    if( !p )
+	return 0;
+    len = p - value;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    pdop = atof( ( const char * )val );
+    return ( len == 5 && !strncasecmp( value, "UTF-8", 5 ) ) ||
+	( len == 8 && !strncasecmp( value, "US-ASCII", 8 ) );
+}
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"extensions" ) ) {
-	    if( !trk_parse_gpx_extensions( track, doc, node, &speed, &azimuth, NULL ) )
-		return 1;
+/*
+ * Read an element name at pos, returning its local part.
+ */
+static const char * trk_scan_name( const char ** pos,
+				   const char  * end,
+				   size_t      * len )
+{
+    const char *p = *pos, *name = p;
+
+    for( ; p < end; p++ ) {
+	if( *p == ':' ) {
+	    name = p + 1;
+	} else if( *p == '>' || *p == '/' ||
+		   *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) {
+	    break;
 	}
     }
 
-    return trk_add_point( track,
-			  time,
-			  latitude,
-			  longitude,
-			  altitude,
-			  azimuth,
-			  speed,
-			  nsat,
-			  fix_type,
-			  hdop,
-			  vdop,
-			  pdop );
+    if( p == end || p == name )
+	return NULL;
+
+    *pos = p;
+    *len = p - name;
+
+    return name;
 }
 
-static int trk_parse_gpx_extensions( track_t       track,
-				     xmlDocPtr     doc,
-				     xmlNodePtr    node,
-				     double      * speed,
-				     double      * azimuth,
-				     const char ** address )
+/*
+ * Skip the attributes of a start tag up to its end, picking the
+ * lat and lon values when asked to.
+ */
+static int trk_scan_attrs( const char ** pos,
+			   const char  * end,
+			   int         * empty,
+			   const char ** lat,
+			   size_t      * lat_len,
+			   const char ** lon,
+			   size_t      * lon_len )
 {
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"TrackPointExtension" ) ) {
-	    if( !trk_parse_gpx_trackpoint_extension( track, doc, node, speed, azimuth ) )
-		return 0;
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"WaypointExtension" ) ) {
-	    if( !trk_parse_gpx_waypoint_extension( track, doc, node, address ) )
+    const char *p = *pos, *name, *value, **val;
+    size_t *val_len;
+    char quote;
+
+    for( ;; ) {
+	while( p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) )
+	    p++;
+	if( p == end )
+	    return 0;
+
+	if( *p == '>' ) {
+	    *empty = 0;
+	    *pos = p + 1;
+	    return 1;
+	}
+
+	if( *p == '/' ) {
+	    if( end - p < 2 || p[1] != '>' )
 		return 0;
+	    *empty = 1;
+	    *pos = p + 2;
+	    return 1;
+	}
+
+	name = p;
+	while( p < end && *p != '=' && *p != ' ' && *p != '\t' &&
+	       *p != '\n' && *p != '\r' && *p != '>' )
+	    p++;
+	value = p;
+
+	while( p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) )
+	    p++;
+	if( p == end || *p != '=' )
+	    return 0;
+	for( p++; p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ); p++ )
+	    ;
+	if( p == end || ( *p != '"' && *p != '\'' ) )
+	    return 0;
+
+	quote = *p++;
+
+	val = NULL;
+	val_len = NULL;
+	if( lat && value - name == 3 && !memcmp( name, "lat", 3 ) ) {
+	    val = lat;
+	    val_len = lat_len;
+	} else if( lon && value - name == 3 && !memcmp( name, "lon", 3 ) ) {
+	    val = lon;
+	    val_len = lon_len;
 	}
+
+	value = p;
+	p = memchr( p, quote, end - p );
+	if( !p )
+	    return 0;
+
+	if( val ) {
+	    *val = value;
+	    *val_len = p - value;
+	}
+
+	p++;
     }
+}
 
-    return 1;
+/*
+ * Values are parsed in place; values with references are left to the
+ * reader.
+ */
+static int trk_scan_value( const char * value, size_t len )
+{
+    return !memchr( value, '&', len );
 }
 
-static int trk_parse_gpx_trackpoint_extension( track_t      track,
-					       xmlDocPtr    doc,
-					       xmlNodePtr   node,
-					       double     * speed,
-					       double     * azimuth )
+static int trk_scan_blank( const char * value, size_t len )
 {
-    double spd = NAN, az = NAN;
+    size_t i;
 
-    ( void )track;
+    for( i = 0; i < len; i++ ) {
+	if( value[i] != ' ' && value[i] != '\t' &&
+	    value[i] != '\n' && value[i] != '\r' )
+	    return 0;
+    }
 
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"speed" ) ) {
-	    xmlChar *val;
+    return 1;
+}
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    spd = atof( ( const char * )val );
+static int trk_read_gpx( track_t track, const void * data, size_t size )
+{
+    xmlTextReaderPtr reader;
+    const xmlChar *name;
+    size_t npoints;
+    int ret, ok = 1;
+
+    npoints = trk_get_npoints( track );
+
+    reader = xmlReaderForMemory( ( const char * )data, size,
+				 NULL, NULL, GPX_PARSE_OPTIONS );
+    if( !reader ) {
+	trk_error( track, "can not parse XML" );
+	return 0;
+    }
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"course" ) ) {
-	    xmlChar *val;
+    while( ok && ( ret = xmlTextReaderRead( reader ) ) == 1 ) {
+	if( xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT )
+	    continue;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    az = atof( ( const char * )val );
+	name = xmlTextReaderConstLocalName( reader );
 
-	    xmlFree( val );
+	if( xmlTextReaderDepth( reader ) == 0 ) {
+	    if( xmlStrcmp( name, ( const xmlChar * )"gpx" ) ) {
+		trk_error( track, "XML type is not supported: '%s'", name );
+		ok = 0;
+	    }
+	} else if( trk_is_gpx_point( ( const char * )name, xmlStrlen( name ) ) ) {
+	    ok = trk_read_gpx_point( track, reader );
 	}
     }
 
-    if( speed )
-	*speed = spd;
-    if( azimuth )
-	*azimuth = az;
+    xmlFreeTextReader( reader );
 
-    return 1;
+    if( ok && ret != 0 ) {
+	trk_error( track, "can not parse XML" );
+	ok = 0;
+    }
+
+    if( !ok )
+	trk_truncate( track, npoints );
+
+    return ok;
 }
 
-static int trk_parse_gpx_waypoint_extension( track_t       track,
-					     xmlDocPtr     doc,
-					     xmlNodePtr    node,
-					     const char ** address )
+/*
+ * Convert the point element the reader is positioned on, consuming it
+ * up to its end tag.
+ */
+static int trk_read_gpx_point( track_t track, xmlTextReaderPtr reader )
 {
-    ( void )track;
+    struct gpx_point point = gpx_point_init;
+    enum gpx_field field = GPX_FIELD_NONE;
+    const xmlChar *name;
+    int depth, type, ret;
+
+    if( xmlTextReaderMoveToAttribute( reader, ( const xmlChar * )"lat" ) != 1 ||
+	!trk_parse_xml_double( reader, &point.latitude ) )
+	point.valid = 0;
+
+    if( xmlTextReaderMoveToAttribute( reader, ( const xmlChar * )"lon" ) != 1 ||
+	!trk_parse_xml_double( reader, &point.longitude ) )
+	point.valid = 0;
+
+    xmlTextReaderMoveToElement( reader );
+
+    if( !xmlTextReaderIsEmptyElement( reader ) ) {
+	depth = xmlTextReaderDepth( reader );
+
+	while( ( ret = xmlTextReaderRead( reader ) ) == 1 ) {
+	    type = xmlTextReaderNodeType( reader );
+
+	    if( type == XML_READER_TYPE_ELEMENT ) {
+		name = xmlTextReaderConstLocalName( reader );
+		field = xmlTextReaderIsEmptyElement( reader ) ? GPX_FIELD_NONE :
+		    trk_gpx_field( ( const char * )name, xmlStrlen( name ) );
+	    } else if( type == XML_READER_TYPE_END_ELEMENT ) {
+		if( xmlTextReaderDepth( reader ) == depth )
+		    break;
+		field = GPX_FIELD_NONE;
+	    } else if( ( type == XML_READER_TYPE_TEXT ||
+			 type == XML_READER_TYPE_CDATA ) && field != GPX_FIELD_NONE ) {
+		const xmlChar *value = xmlTextReaderConstValue( reader );
+
+		trk_parse_gpx_value( &point, field, ( const char * )value,
+				     xmlStrlen( value ) );
+	    }
+	}
 
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Address" ) ) {
-	    if( !trk_parse_gpx_waypoint_address( track, doc, node, address ) )
-		return 0;
+	if( ret != 1 ) {
+	    trk_error( track, "can not parse XML" );
+	    return 0;
 	}
     }
 
+    if( !point.valid )
+	return 1;
+
+    if( !trk_add_gpx_point( track, &point ) ) {
+	trk_error( track, "can not add point: %s", strerror( errno ) );
+	return 0;
+    }
+
     return 1;
 }
 
-static int trk_parse_gpx_waypoint_address( track_t       track,
-					   xmlDocPtr     doc,
-					   xmlNodePtr    node,
-					   const char ** address )
+/*
+ * Parse the value of the current reader node as a number.
+ */
+static int trk_parse_xml_double( xmlTextReaderPtr reader, double * value )
 {
-    char *addr = NULL;
-    int xmlLen;
-    size_t len;
+    const xmlChar *str = xmlTextReaderConstValue( reader );
 
-    ( void )track;
-
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"StreetAddress" ) ) {
-	    xmlChar *val;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    xmlLen = xmlStrlen( val );
-	    len = addr ? strlen( addr ) : 0;
-	    addr = realloc( addr, xmlLen + len + 1 );
-	    strncpy( addr + len, ( const char * )val, xmlLen );
-	    strncpy( addr + len + xmlLen, " ", 1 );
-
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"City" ) ) {
-	    xmlChar *val;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    xmlLen = xmlStrlen( val );
-	    len = addr ? strlen( addr ) : 0;
-	    addr = realloc( addr, xmlLen + len + 1 );
-	    strncpy( addr + len, ( const char * )val, xmlLen );
-	    strncpy( addr + len + xmlLen, " ", 1 );
-
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Country" ) ) {
-	    xmlChar *val;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    xmlLen = xmlStrlen( val );
-	    len = addr ? strlen( addr ) : 0;
-	    addr = realloc( addr, xmlLen + len + 1 );
-	    strncpy( addr + len, ( const char * )val, xmlLen );
-	    strncpy( addr + len + xmlLen, " ", 1 );
-
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"PostalCode" ) ) {
-	    xmlChar *val;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    xmlLen = xmlStrlen( val );
-	    len = addr ? strlen( addr ) : 0;
-	    addr = realloc( addr, xmlLen + len + 1 );
-	    strncpy( addr + len, ( const char * )val, xmlLen );
-	    strncpy( addr + len + xmlLen, " ", 1 );
-
-	    xmlFree( val );
-	}
+    return str && trk_parse_double( ( const char * )str, xmlStrlen( str ), value );
+}
+
+static int trk_is_gpx_point( const char * name, size_t len )
+{
+    if( len == 5 && !memcmp( name, "trkpt", 5 ) )
+	return 1;
+#ifdef PARSE_GPX_WAYPOINTS
+    if( len == 3 && !memcmp( name, "wpt", 3 ) )
+	return 1;
+#endif
+
+    return 0;
+}
+
+static enum gpx_field trk_gpx_field( const char * name, size_t len )
+{
+    size_t i;
+
+    for( i = 0; i < sizeof( gpx_fields ) / sizeof( gpx_fields[0] ); i++ ) {
+	if( gpx_fields[i].len == len && !memcmp( gpx_fields[i].name, name, len ) )
+	    return gpx_fields[i].field;
     }
 
-    if( address )
-	*address = addr;
-    else
-	free( addr );
+    return GPX_FIELD_NONE;
+}
 
-    return 1;
+static void trk_parse_gpx_value( struct gpx_point * point,
+				 enum gpx_field     field,
+				 const char       * val,
+				 size_t             len )
+{
+    switch( field ) {
+    case GPX_FIELD_ELE:
+	trk_parse_double( val, len, &point->altitude );
+	break;
+    case GPX_FIELD_TIME:
+	/* points with unparsable time are skipped */
+	if( !trk_parse_isotime( val, len, &point->time ) )
+	    point->valid = 0;
+	break;
+    case GPX_FIELD_COURSE:
+	trk_parse_double( val, len, &point->azimuth );
+	break;
+    case GPX_FIELD_SPEED:
+	trk_parse_double( val, len, &point->speed );
+	break;
+    case GPX_FIELD_SAT:
+	trk_parse_int( val, len, &point->nsat );
+	break;
+    case GPX_FIELD_FIX:
+	if( len == 2 && !memcmp( val, "2d", 2 ) )
+	    point->fix_type = 2;
+	else if( len == 2 && !memcmp( val, "3d", 2 ) )
+	    point->fix_type = 3;
+	break;
+    case GPX_FIELD_HDOP:
+	trk_parse_double( val, len, &point->hdop );
+	break;
+    case GPX_FIELD_VDOP:
+	trk_parse_double( val, len, &point->vdop );
+	break;
+    case GPX_FIELD_PDOP:
+	trk_parse_double( val, len, &point->pdop );
+	break;
+    case GPX_FIELD_NONE:
+	break;
+    }
 }
 
+static int trk_add_gpx_point( track_t track, const struct gpx_point * point )
+{
+    return trk_add_point( track,
+			  point->time,
+			  point->latitude,
+			  point->longitude,
+			  point->altitude,
+			  point->azimuth,
+			  point->speed,
+			  point->nsat,
+			  point->fix_type,
+			  point->hdop,
+			  point->vdop,
+			  point->pdop );
+}
@@ -13,13 +13,12 @@
 #define GPX_H_INCLUDED
 
 
-#include <libxml/parser.h>
+#include <stddef.h>
 
 #include "track.h"
 
 
-int trk_parse_gpx( track_t track, xmlDocPtr doc, xmlNodePtr node );
+int trk_parse_gpx( track_t track, const void * data, size_t size );
 
 
 #endif
-
@@ -0,0 +1,206 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, live tracks.
+ *
+ */
+
+/**
+ * @file live.c Live track implementation.
+ *
+ * A live track has one writer appending points while readers query it
+ * without locks. The writer appends into spare column capacity and then
+ * commits the new point count with release semantics; a reader loads
+ * the count with acquire semantics and only looks at points below it,
+ * so it always sees a consistent prefix of the track.
+ *
+ * Growing the columns moves the points to new arrays, published through
+ * a view pointer. The old arrays are freed after a grace period: readers
+ * register in one of two counters picked by the parity of the current
+ * epoch, and the writer flips the epoch and waits for the counter of the
+ * previous one to drain. Readers never wait; the writer only waits when
+ * the columns grow.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <sched.h>
+
+#include "live.h"
+
+
+/* keeps the reader counters and the writer fields on their own cache lines */
+#define LIVE_CACHE_LINE 64
+
+
+struct live_o {
+    /* points the readers see, but for their count */
+    _Atomic( struct points_o * )  view;
+    atomic_size_t                 count;
+
+    atomic_uint                   epoch __attribute__ ((aligned(LIVE_CACHE_LINE)));
+
+    /* readers in an even and an odd epoch */
+    atomic_size_t                 readers[2] __attribute__ ((aligned(LIVE_CACHE_LINE)));
+};
+
+
+static void trk_live_synchronize( live_t live );
+
+
+
+live_t trk_live_make( const struct points_o * points )
+{
+    live_t live;
+    struct points_o *view;
+
+    assert( points );
+
+    view = malloc( sizeof( *view ) );
+    if( !view )
+	return NULL;
+
+    if( posix_memalign( ( void ** )&live, LIVE_CACHE_LINE, sizeof( *live ) ) ) {
+	free( view );
+	return NULL;
+    }
+
+    *view = *points;
+
+    atomic_init( &live->view, view );
+    atomic_init( &live->count, points->count );
+    atomic_init( &live->epoch, 0 );
+    atomic_init( &live->readers[0], 0 );
+    atomic_init( &live->readers[1], 0 );
+
+    return live;
+}
+
+/*
+ * No reader may be left. The columns belong to the writer's store.
+ */
+void trk_live_drop( live_t live )
+{
+    if( !live )
+	return;
+
+    assert( atomic_load( &live->readers[0] ) == 0 );
+    assert( atomic_load( &live->readers[1] ) == 0 );
+
+    free( atomic_load( &live->view ) );
+    free( live );
+}
+
+/*
+ * Move the writer's points to larger columns (see trk_points_relocate())
+ * and free the previous ones once no reader can use them.
+ */
+int trk_live_grow( live_t live, points_t points, size_t capacity )
+{
+    struct points_o old;
+
+    assert( live && points );
+
+    if( !trk_points_relocate( points, capacity, &old ) )
+	return 0;
+
+    if( !trk_live_publish( live, points ) ) {
+	trk_points_free( points );
+	*points = old;
+	return 0;
+    }
+
+    trk_points_free( &old );
+
+    return 1;
+}
+
+/*
+ * Make readers use the writer's current columns and time origin; the
+ * point count is published separately by trk_live_commit(). Returns
+ * once readers of the previous view are gone.
+ */
+int trk_live_publish( live_t live, const struct points_o * points )
+{
+    struct points_o *view, *old;
+
+    assert( live && points );
+
+    view = malloc( sizeof( *view ) );
+    if( !view )
+	return 0;
+
+    *view = *points;
+
+    old = atomic_exchange( &live->view, view );
+    trk_live_synchronize( live );
+    free( old );
+
+    return 1;
+}
+
+/*
+ * Publish the point count; points below it must be completely written,
+ * their segments included.
+ */
+void trk_live_commit( live_t live, size_t count )
+{
+    assert( live );
+
+    atomic_store_explicit( &live->count, count, memory_order_release );
+}
+
+/*
+ * Begin a read: fill view with the published points and return it. The
+ * view stays valid until trk_live_leave() with the returned epoch.
+ */
+const struct points_o * trk_live_enter( live_t            live,
+					struct points_o * view,
+					unsigned        * epoch )
+{
+    unsigned e;
+    size_t count;
+
+    assert( live && view && epoch );
+
+    /* a reader counted in an epoch the writer already flipped away from
+     * might be missed by its wait, so it retries in the new one */
+    for( ;; ) {
+	e = atomic_load( &live->epoch );
+	atomic_fetch_add( &live->readers[e & 1], 1 );
+	if( atomic_load( &live->epoch ) == e )
+	    break;
+	atomic_fetch_sub( &live->readers[e & 1], 1 );
+    }
+    *epoch = e;
+
+    /* the count first: any view published after it holds those points */
+    count = atomic_load_explicit( &live->count, memory_order_acquire );
+
+    *view = *atomic_load( &live->view );
+    view->count = count;
+
+    return view;
+}
+
+void trk_live_leave( live_t live, unsigned epoch )
+{
+    assert( live );
+
+    atomic_fetch_sub_explicit( &live->readers[epoch & 1], 1, memory_order_release );
+}
+
+
+/*
+ * Wait for every reader that may have seen the view replaced before the
+ * call. Readers arriving after the epoch flip see the new view.
+ */
+static void trk_live_synchronize( live_t live )
+{
+    unsigned e;
+
+    e = atomic_fetch_add( &live->epoch, 1 );
+
+    while( atomic_load_explicit( &live->readers[e & 1], memory_order_acquire ) )
+	sched_yield();
+}
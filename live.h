@@ -0,0 +1,40 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, live tracks.
+ *
+ */
+
+/**
+ * @file live.h Live track header.
+ */
+
+#ifndef LIVE_H_INCLUDED
+#define LIVE_H_INCLUDED
+
+
+#include <stddef.h>
+
+#include "point.h"
+
+
+typedef struct live_o * live_t;
+
+
+live_t trk_live_make( const struct points_o * points );
+
+void trk_live_drop( live_t live );
+
+int trk_live_grow( live_t live, points_t points, size_t capacity );
+
+int trk_live_publish( live_t live, const struct points_o * points );
+
+void trk_live_commit( live_t live, size_t count );
+
+const struct points_o * trk_live_enter( live_t            live,
+					struct points_o * view,
+					unsigned        * epoch );
+
+void trk_live_leave( live_t live, unsigned epoch );
+
+
+#endif
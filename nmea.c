@@ -6,12 +6,33 @@
 
 /**
  * @file nmea.c NMEA parser implementation.
+ *
+ * The input is split into lines in place; minmea wants NUL-terminated
+ * sentences, so each line (at most MINMEA_MAX_LENGTH + 3 bytes, longer
+ * ones are invalid anyway) is handed over through a stack buffer.
+ *
+ * With more than one thread the input is cut at line boundaries into
+ * chunks. Every chunk but the first is parsed by a worker into its own
+ * point store, starting from an empty epoch state. The chunks are then
+ * joined in order: the lines of a chunk up to its first point are
+ * parsed again with the real state carried over from the previous
+ * chunk. If that also emits a point on the same line, both states are
+ * equal from there on and the rest of the worker points are taken as
+ * they are; otherwise the chunk is parsed again sequentially.
+ *
+ * A fed stream keeps its epoch state and unterminated last line between
+ * calls. The complete lines of each call are parsed into a scratch
+ * store whose points are then appended to the track.
  */
 
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "minmea.h"
 
@@ -19,123 +40,893 @@
 #include "track_priv.h"
 
 
+/*
+ * Rough NMEA bytes per epoch (RMC + GGA + GSA and usually a few more),
+ * used to presize the track from the input length.
+ */
+#define NMEA_BYTES_PER_EPOCH 256
+
+/* longest sentence minmea accepts: MINMEA_MAX_LENGTH plus "*hh" */
+#define NMEA_LINE_MAX ( MINMEA_MAX_LENGTH + 3 )
+
+/* smallest input worth a thread */
+#define NMEA_CHUNK_MIN ( 1 << 20 )
+
+
+/*
+ * Values collected from the sentences of the current epoch. A point is
+ * emitted once RMC, GGA and GSA have all been seen; values not updated
+ * by the next epoch carry over.
+ */
+struct nmea_state {
+    double           latitude;
+    double           longitude;
+    double           altitude;
+    double           azimuth;
+    double           speed;
+    int              nsat;
+    int              fix_type;
+    double           hdop;
+    double           vdop;
+    double           pdop;
+    struct timespec  ts;
+
+    unsigned         sentences;	/* TRK_NMEA_* making up a point */
+    unsigned         have;	/* TRK_NMEA_* seen since the last point */
+};
+
+struct nmea_chunk {
+    const char         * data;
+    const char         * end;
+
+    struct points_o      points;
+    struct nmea_state    state;	/* at the end of the chunk */
+    const char         * first;	/* end of the line emitting the first point */
+    int                  ret;
+
+    pthread_t            thread;
+    int                  started;
+};
+
+struct nmea_feed {
+    struct nmea_state    state;
+    struct points_o      points;	/* of the current call */
+
+    /* unterminated last line; len may exceed the buffer for lines too
+     * long to be valid, which are dropped */
+    char                 line[NMEA_LINE_MAX];
+    size_t               len;
+};
+
+
+static int trk_parse_nmea_chunks( points_t     points,
+				  const char * data,
+				  size_t       size,
+				  unsigned     nchunks,
+				  unsigned     sentences );
+static void * trk_nmea_worker( void * arg );
+static int trk_nmea_join( points_t            points,
+			  struct nmea_state * state,
+			  struct nmea_chunk * chunk );
+static void trk_nmea_state_init( struct nmea_state * state, unsigned sentences );
+static int trk_parse_nmea_range( points_t            points,
+				 struct nmea_state * state,
+				 const char        * data,
+				 const char        * end,
+				 const char       ** first );
+static const char * trk_nmea_first_eol( const char * data, const char * end );
+static const char * trk_nmea_last_eol( const char * data, const char * end );
+static void trk_nmea_feed_keep( struct nmea_feed * feed, const char * data, const char * end );
+static int trk_nmea_feed_append( track_t track, const struct points_o * fed );
+static unsigned trk_nmea_sentence( const char * line );
+static int trk_parse_nmea_line( points_t            points,
+				struct nmea_state * state,
+				unsigned            sentence,
+				const char        * line );
+static bool trk_nmea_parse_rmc( struct minmea_sentence_rmc * frame, const char * sentence );
+static bool trk_nmea_parse_gga( struct minmea_sentence_gga * frame, const char * sentence );
+static bool trk_nmea_parse_gsa( struct minmea_sentence_gsa * frame, const char * sentence );
+
+
+
+int trk_parse_nmea( track_t track, const void * data, size_t size )
+{
+    struct nmea_state state;
+    size_t npoints;
+    unsigned nchunks, sentences;
+    int ret;
+
+    npoints = trk_get_npoints( track );
+
+    if( !trk_reserve( track, npoints + size / NMEA_BYTES_PER_EPOCH ) )
+	return 0;
+
+    nchunks = trk_get_nmea_threads( track );
+    if( nchunks > size / NMEA_CHUNK_MIN )
+	nchunks = size / NMEA_CHUNK_MIN;
+
+    sentences = trk_get_nmea_sentences( track );
+
+    if( nchunks > 1 ) {
+	ret = trk_parse_nmea_chunks( trk_get_points( track ), data, size,
+				     nchunks, sentences );
+    } else {
+	trk_nmea_state_init( &state, sentences );
+	ret = trk_parse_nmea_range( trk_get_points( track ), &state,
+				    ( const char * )data, ( const char * )data + size,
+				    NULL );
+    }
+
+    if( !ret ) {
+	trk_error( track, "can not parse NMEA: %s", strerror( errno ) );
+	trk_truncate( track, npoints );
+    }
+
+    return ret;
+}
+
+/*
+ * Feed a chunk of an NMEA stream; chunks may end anywhere, even within
+ * a sentence. Points are appended as their epochs complete.
+ */
+TU_EXPORT int trk_nmea_feed( track_t track, const void * bytes, size_t n )
+{
+    struct nmea_feed *feed;
+    const char *data = bytes, *end = data + n, *eol;
+    int ret = 1;
+
+    assert( track );
+    assert( bytes || n == 0 );
+
+    feed = trk_get_nmea_feed( track );
+    if( !feed ) {
+	feed = malloc( sizeof( *feed ) );
+	if( !feed ) {
+	    trk_error( track, "can not feed NMEA: %s", strerror( ENOMEM ) );
+	    return 0;
+	}
+	trk_nmea_state_init( &feed->state, trk_get_nmea_sentences( track ) );
+	trk_points_init( &feed->points );
+	feed->len = 0;
+	trk_set_nmea_feed( track, feed );
+    }
+
+    feed->points.count = 0;
+
+    /* finish the line left over by the previous chunk */
+    if( feed->len ) {
+	eol = trk_nmea_first_eol( data, end );
+	trk_nmea_feed_keep( feed, data, eol ? eol : end );
+	if( !eol )
+	    return 1;
+
+	if( feed->len <= NMEA_LINE_MAX )
+	    ret = trk_parse_nmea_range( &feed->points, &feed->state,
+					feed->line, feed->line + feed->len, NULL );
+	feed->len = 0;
+	data = eol;
+    }
+
+    eol = trk_nmea_last_eol( data, end );
+    if( eol ) {
+	ret = ret && trk_parse_nmea_range( &feed->points, &feed->state,
+					   data, eol + 1, NULL );
+	data = eol + 1;
+    }
+
+    trk_nmea_feed_keep( feed, data, end );
+
+    if( !ret ) {
+	trk_error( track, "can not parse NMEA: %s", strerror( errno ) );
+	return 0;
+    }
+
+    return trk_nmea_feed_append( track, &feed->points );
+}
+
+void trk_nmea_feed_free( struct nmea_feed * feed )
+{
+    if( !feed )
+	return;
+
+    trk_points_free( &feed->points );
+    free( feed );
+}
+
+
+static int trk_parse_nmea_chunks( points_t     points,
+				  const char * data,
+				  size_t       size,
+				  unsigned     nchunks,
+				  unsigned     sentences )
+{
+    struct nmea_chunk *chunks;
+    struct nmea_state state;
+    const char *p, *q, *end = data + size;
+    unsigned i;
+    int ret = 1;
+
+    chunks = calloc( nchunks, sizeof( *chunks ) );
+    if( !chunks )
+	return 0;
+
+    /* cut after a line end, the first chunk starts at the data start */
+    for( i = 0, p = data; i < nchunks; i++ ) {
+	chunks[i].data = p;
+	if( i + 1 < nchunks ) {
+	    q = data + size / nchunks * ( i + 1 );
+	    if( q < p )
+		q = p;
+	    p = memchr( q, '\n', end - q );
+	    p = p ? p + 1 : end;
+	} else {
+	    p = end;
+	}
+	chunks[i].end = p;
+
+	trk_points_init( &chunks[i].points );
+	trk_nmea_state_init( &chunks[i].state, sentences );
+    }
+
+    for( i = 1; i < nchunks; i++ ) {
+	chunks[i].started = !pthread_create( &chunks[i].thread, NULL,
+					     trk_nmea_worker, &chunks[i] );
+    }
+
+    trk_nmea_state_init( &state, sentences );
+    ret = trk_parse_nmea_range( points, &state, chunks[0].data, chunks[0].end, NULL );
+
+    for( i = 1; i < nchunks; i++ ) {
+	if( ret ) {
+	    ret = trk_nmea_join( points, &state, &chunks[i] );
+	} else if( chunks[i].started ) {
+	    pthread_join( chunks[i].thread, NULL );
+	}
+	trk_points_free( &chunks[i].points );
+    }
+
+    free( chunks );
+
+    return ret;
+}
+
+static void * trk_nmea_worker( void * arg )
+{
+    struct nmea_chunk *chunk = arg;
+
+    chunk->first = NULL;
+    chunk->ret = trk_points_reserve( &chunk->points,
+				     ( chunk->end - chunk->data ) / NMEA_BYTES_PER_EPOCH ) &&
+	trk_parse_nmea_range( &chunk->points, &chunk->state,
+			      chunk->data, chunk->end, &chunk->first );
+
+    return NULL;
+}
+
+/*
+ * Append the points of a chunk, state is the epoch state at its start.
+ */
+static int trk_nmea_join( points_t            points,
+			  struct nmea_state * state,
+			  struct nmea_chunk * chunk )
+{
+    if( !chunk->started )
+	return trk_parse_nmea_range( points, state, chunk->data, chunk->end, NULL );
+
+    pthread_join( chunk->thread, NULL );
+
+    if( !chunk->ret )
+	return 0;
+
+    if( !chunk->first )
+	return trk_parse_nmea_range( points, state, chunk->data, chunk->end, NULL );
+
+    if( !trk_parse_nmea_range( points, state, chunk->data, chunk->first, NULL ) )
+	return 0;
+
+    /* the first line emitting a point sets a flag unless it emits here too */
+    if( state->have )
+	return trk_parse_nmea_range( points, state, chunk->first, chunk->end, NULL );
+
+    *state = chunk->state;
+
+    return trk_points_append_points( points, &chunk->points, 1 );
+}
+
+
+static void trk_nmea_state_init( struct nmea_state * state, unsigned sentences )
+{
+    state->latitude  = NAN;
+    state->longitude = NAN;
+    state->altitude  = NAN;
+    state->azimuth   = NAN;
+    state->speed     = NAN;
+    state->nsat      = -1;
+    state->fix_type  = -1;
+    state->hdop      = NAN;
+    state->vdop      = NAN;
+    state->pdop      = NAN;
+    state->ts.tv_sec  = 0;
+    state->ts.tv_nsec = 0;
+
+    state->sentences = sentences;
+    state->have      = 0;
+}
+
+/*
+ * Parse the lines of [data, end). Lines end at '\n' or '\r'.
+ * When first is given, it is set to the end of the line emitting
+ * the first point, or left alone if no point is emitted.
+ */
+static int trk_parse_nmea_range( points_t            points,
+				 struct nmea_state * state,
+				 const char        * data,
+				 const char        * end,
+				 const char       ** first )
+{
+    size_t count = points->count;
+    char line[NMEA_LINE_MAX + 1];
+    const char *p, *eol, *cr;
+    unsigned sentence;
+    size_t len;
+
+    for( p = data; p < end; p = eol + 1 ) {
+	eol = memchr( p, '\n', end - p );
+	if( !eol )
+	    eol = end;
+
+	cr = memchr( p, '\r', eol - p );
+	if( cr )
+	    eol = cr;
+
+	/* the shortest sentence is "$ttsss" */
+	len = eol - p;
+	if( len < 6 || len > NMEA_LINE_MAX )
+	    continue;
+
+	/* unwanted sentences are dropped before any checking */
+	sentence = trk_nmea_sentence( p );
+	if( !( sentence & state->sentences ) )
+	    continue;
+
+	memcpy( line, p, len );
+	line[len] = '\0';
+
+	if( !trk_parse_nmea_line( points, state, sentence, line ) )
+	    return 0;
+
+	if( first && !*first && points->count > count )
+	    *first = eol;
+    }
+
+    return 1;
+}
+
+static const char * trk_nmea_first_eol( const char * data, const char * end )
+{
+    for( ; data < end; data++ ) {
+	if( *data == '\n' || *data == '\r' )
+	    return data;
+    }
+
+    return NULL;
+}
+
+static const char * trk_nmea_last_eol( const char * data, const char * end )
+{
+    while( end > data ) {
+	end--;
+	if( *end == '\n' || *end == '\r' )
+	    return end;
+    }
+
+    return NULL;
+}
+
+/*
+ * Add the bytes of [data, end) to the unterminated line.
+ */
+static void trk_nmea_feed_keep( struct nmea_feed * feed, const char * data, const char * end )
+{
+    size_t n = end - data;
+
+    if( feed->len + n > NMEA_LINE_MAX ) {
+	feed->len = NMEA_LINE_MAX + 1;
+	return;
+    }
+
+    memcpy( feed->line + feed->len, data, n );
+    feed->len += n;
+}
+
+/*
+ * Append fed points after the end of the track. Epochs not after it,
+ * repeated or late, and fixes without position are dropped, as a load
+ * would merge or drop them.
+ */
+static int trk_nmea_feed_append( track_t track, const struct points_o * fed )
+{
+    const struct points_o *points = trk_get_points( track );
+    int64_t time;
+    size_t i;
+
+    for( i = 0; i < fed->count; i++ ) {
+	time = trk_point_time( fed, i );
+
+	if( points->count && time <= trk_point_time( points, points->count - 1 ) )
+	    continue;
+	if( isnan( trk_point_latitude( fed, i ) ) || isnan( trk_point_longitude( fed, i ) ) )
+	    continue;
+
+	if( !trk_append_point( track, time,
+			       trk_point_latitude( fed, i ),
+			       trk_point_longitude( fed, i ),
+			       trk_point_altitude( fed, i ),
+			       trk_point_azimuth( fed, i ),
+			       trk_point_speed( fed, i ),
+			       trk_point_nsat( fed, i ),
+			       trk_point_fix_type( fed, i ),
+			       trk_point_hdop( fed, i ),
+			       trk_point_vdop( fed, i ),
+			       trk_point_pdop( fed, i ) ) )
+	    return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Sentence of a line of at least 6 bytes, from the three characters
+ * after the talker ID; 0 for sentences not used for points.
+ */
+static unsigned trk_nmea_sentence( const char * line )
+{
+    uint32_t id;
+
+    if( line[0] != '$' )
+	return 0;
+
+    id = ( uint32_t )( unsigned char )line[3] << 16 |
+	( uint32_t )( unsigned char )line[4] << 8 |
+	( unsigned char )line[5];
+
+    switch( id ) {
+    case 'R' << 16 | 'M' << 8 | 'C':
+	return TRK_NMEA_RMC;
+    case 'G' << 16 | 'G' << 8 | 'A':
+	return TRK_NMEA_GGA;
+    case 'G' << 16 | 'S' << 8 | 'A':
+	return TRK_NMEA_GSA;
+    }
+
+    return 0;
+}
 
-int trk_parse_nmea( track_t track, void * data, size_t size )
+static int trk_parse_nmea_line( points_t            points,
+				struct nmea_state * state,
+				unsigned            sentence,
+				const char        * line )
 {
-    char *delim = "\r\n";
-    char *buf, *line;
     struct minmea_sentence_rmc rmc_frame;
     struct minmea_sentence_gga gga_frame;
     struct minmea_sentence_gsa gsa_frame;
-    struct minmea_sentence_gst gst_frame;
-    struct minmea_sentence_gll gll_frame;
-    struct minmea_sentence_gsv gsv_frame;
-    struct minmea_sentence_vtg vtg_frame;
-    bool have_rmc = false,
-	have_gga = false,
-	have_gsa = false,
-	have_gst = false,
-	have_gll = false,
-	have_gsv = false,
-	have_vtg = false;
-    double latitude = NAN, longitude = NAN, altitude = NAN, azimuth = NAN, speed = NAN;
-    int nsat = -1, fix_type = -1;
-    double hdop = NAN, vdop = NAN, pdop = NAN;
-    struct timespec ts;
-
-    buf = strdup( data );
-
-    line = strtok( buf, delim );
-    while( line ) {
-	switch( minmea_sentence_id( line, true ) ) {
-	case MINMEA_SENTENCE_RMC:
-	    if( minmea_parse_rmc( &rmc_frame, line ) ) {
-		if( rmc_frame.valid ) {
-		    latitude = minmea_tocoord( &rmc_frame.latitude );
-		    longitude = minmea_tocoord( &rmc_frame.longitude );
-		    azimuth = minmea_tofloat( &rmc_frame.course );
-		    speed = minmea_tofloat( &rmc_frame.speed ) * .514444;
-		    minmea_gettime( &ts, &rmc_frame.date, &rmc_frame.time );
-
-		    have_rmc = true;
-		}
-	    }
-	    break;
-	case MINMEA_SENTENCE_GGA:
-	    if( minmea_parse_gga( &gga_frame, line ) ) {
-		nsat = gga_frame.satellites_tracked;
-		altitude = minmea_tofloat( &gga_frame.altitude );
 
-		have_gga = true;
-	    }
-	    break;
-	case MINMEA_SENTENCE_GSA:
-	    if( minmea_parse_gsa( &gsa_frame, line ) ) {
-		fix_type = gsa_frame.fix_type;
-		hdop = minmea_tofloat( &gsa_frame.hdop );
-		vdop = minmea_tofloat( &gsa_frame.vdop );
-		pdop = minmea_tofloat( &gsa_frame.pdop );
-
-		have_gsa = true;
-	    }
-	    break;
-	case MINMEA_SENTENCE_GST:
-	    if( minmea_parse_gst( &gst_frame, line ) ) {
-		have_gst = true;
-	    }
-	    break;
-	case MINMEA_SENTENCE_GLL:
-	    if( minmea_parse_gll( &gll_frame, line ) ) {
-		have_gll = true;
-	    }
-	    break;
-	case MINMEA_SENTENCE_GSV:
-	    if( minmea_parse_gsv( &gsv_frame, line ) ) {
-		have_gsv = true;
-	    }
-	    break;
-	case MINMEA_SENTENCE_VTG:
-	    if( minmea_parse_vtg( &vtg_frame, line ) ) {
-		have_vtg = true;
-	    }
-	    break;
-	case MINMEA_INVALID:
-	    break;
-	default:
-	    break;
-	}
+    if( !minmea_check( line, true ) )
+	return 1;
 
-	if( have_rmc && have_gga && have_gsa ) {
-	    if( !trk_add_point( track,
-				ts.tv_sec,
-				latitude,
-				longitude,
-				altitude,
-				azimuth,
-				speed,
-				nsat,
-				fix_type,
-				hdop,
-				vdop,
-				pdop ) ) {
-		free( buf );
-		return 0;
+    switch( sentence ) {
+    case TRK_NMEA_RMC:
+	if( trk_nmea_parse_rmc( &rmc_frame, line ) ) {
+	    if( rmc_frame.valid ) {
+		state->latitude = minmea_tocoord( &rmc_frame.latitude );
+		state->longitude = minmea_tocoord( &rmc_frame.longitude );
+		state->azimuth = minmea_tofloat( &rmc_frame.course );
+		state->speed = minmea_tofloat( &rmc_frame.speed ) * .514444;
+		minmea_gettime( &state->ts, &rmc_frame.date, &rmc_frame.time );
+
+		state->have |= TRK_NMEA_RMC;
 	    }
+	}
+	break;
+    case TRK_NMEA_GGA:
+	if( trk_nmea_parse_gga( &gga_frame, line ) ) {
+	    state->nsat = gga_frame.satellites_tracked;
+	    state->altitude = minmea_tofloat( &gga_frame.altitude );
 
-	    have_rmc = false;
-	    have_gga = false;
-	    have_gsa = false;
-	    have_gst = false;
-	    have_gll = false;
-	    have_gsv = false;
-	    have_vtg = false;
+	    state->have |= TRK_NMEA_GGA;
 	}
+	break;
+    case TRK_NMEA_GSA:
+	if( trk_nmea_parse_gsa( &gsa_frame, line ) ) {
+	    state->fix_type = gsa_frame.fix_type;
+	    state->hdop = minmea_tofloat( &gsa_frame.hdop );
+	    state->vdop = minmea_tofloat( &gsa_frame.vdop );
+	    state->pdop = minmea_tofloat( &gsa_frame.pdop );
 
-	line = strtok( NULL, delim );
+	    state->have |= TRK_NMEA_GSA;
+	}
+	break;
     }
 
-    free( buf );
+    if( state->have == state->sentences ) {
+	if( !trk_points_append( points,
+				( int64_t )state->ts.tv_sec * TRK_NSEC_PER_SEC + state->ts.tv_nsec,
+				state->latitude,
+				state->longitude,
+				state->altitude,
+				state->azimuth,
+				state->speed,
+				state->nsat,
+				state->fix_type,
+				state->hdop,
+				state->vdop,
+				state->pdop ) )
+	    return 0;
+
+	state->have = 0;
+    }
 
     return 1;
 }
 
+/*
+ * Specialized RMC, GGA and GSA parsers. They fill the minmea frames
+ * exactly as minmea_parse_rmc/gga/gsa() do, field for field and with
+ * the same error cases, without going through the minmea_scan() format
+ * interpreter: no varargs, no strtol.
+ */
+
+static inline bool trk_nmea_isfield( char c )
+{
+    /* isprint() in the C locale */
+    return c >= 0x20 && c <= 0x7e && c != ',' && c != '*';
+}
+
+static inline bool trk_nmea_isdigit( char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+/*
+ * Skip the current field; the next one, or NULL at the end.
+ */
+static inline const char * trk_nmea_next( const char ** sentence )
+{
+    const char *p = *sentence;
+
+    while( trk_nmea_isfield( *p ) )
+	p++;
+
+    if( *p != ',' ) {
+	*sentence = p;
+	return NULL;
+    }
+
+    *sentence = ++p;
+
+    return p;
+}
+
+/* "t": talker and sentence, the type is the last three characters */
+static inline bool trk_nmea_type( const char * field, const char * type )
+{
+    int f;
+
+    if( field[0] != '$' )
+	return false;
+
+    for( f = 1; f <= 5; f++ ) {
+	if( !trk_nmea_isfield( field[f] ) )
+	    return false;
+    }
+
+    return field[3] == type[0] && field[4] == type[1] && field[5] == type[2];
+}
+
+/* "c" */
+static inline char trk_nmea_char( const char * field )
+{
+    return trk_nmea_isfield( *field ) ? *field : '\0';
+}
+
+/* "d" */
+static inline bool trk_nmea_direction( const char * field, int * value )
+{
+    *value = 0;
+
+    if( !trk_nmea_isfield( *field ) )
+	return true;
+
+    switch( *field ) {
+    case 'N':
+    case 'E':
+	*value = 1;
+	return true;
+    case 'S':
+    case 'W':
+	*value = -1;
+	return true;
+    }
+
+    return false;
+}
+
+/* "f" */
+static bool trk_nmea_float( const char * field, struct minmea_float * f )
+{
+    int sign = 0, digit;
+    int_least32_t value = -1, scale = 0;
+
+    for( ; trk_nmea_isfield( *field ); field++ ) {
+	if( trk_nmea_isdigit( *field ) ) {
+	    digit = *field - '0';
+	    if( value == -1 )
+		value = 0;
+	    if( value > ( INT_LEAST32_MAX - digit ) / 10 ) {
+		/* extra precision is truncated, integer overflow is an error */
+		if( scale )
+		    break;
+		return false;
+	    }
+	    value = 10 * value + digit;
+	    if( scale )
+		scale *= 10;
+	} else if( *field == '.' && scale == 0 ) {
+	    scale = 1;
+	} else if( ( *field == '+' || *field == '-' ) && !sign && value == -1 ) {
+	    sign = *field == '+' ? 1 : -1;
+	} else if( *field == ' ' ) {
+	    /* leading spaces only */
+	    if( sign != 0 || value != -1 || scale != 0 )
+		return false;
+	} else {
+	    return false;
+	}
+    }
+
+    if( ( sign || scale ) && value == -1 )
+	return false;
+
+    if( value == -1 ) {
+	value = 0;
+	scale = 0;
+    } else if( scale == 0 ) {
+	scale = 1;
+    }
+    if( sign )
+	value *= sign;
+
+    f->value = value;
+    f->scale = scale;
+
+    return true;
+}
+
+/* "i": strtol() up to the field end */
+static bool trk_nmea_int( const char * field, int * value )
+{
+    const char *p = field;
+    unsigned long v = 0, limit;
+    bool neg = false, digits = false, overflow = false;
+
+    while( *p == ' ' || ( *p >= '\t' && *p <= '\r' ) )
+	p++;
+
+    if( *p == '+' || *p == '-' )
+	neg = *p++ == '-';
+
+    limit = neg ? ( unsigned long )LONG_MAX + 1 : ( unsigned long )LONG_MAX;
+
+    for( ; trk_nmea_isdigit( *p ); p++ ) {
+	digits = true;
+	if( overflow || v > ( limit - ( *p - '0' ) ) / 10 )
+	    overflow = true;
+	else
+	    v = v * 10 + ( *p - '0' );
+    }
+
+    if( !digits )
+	p = field;
+    else if( overflow )
+	v = limit;
+
+    if( trk_nmea_isfield( *p ) )
+	return false;
+
+    *value = ( int )( neg ? -( long )( v - 1 ) - 1 : ( long )v );
+
+    return true;
+}
+
+/* "D" */
+static inline bool trk_nmea_date( const char * field, struct minmea_date * date )
+{
+    int f;
+
+    date->day = date->month = date->year = -1;
+
+    if( !trk_nmea_isfield( *field ) )
+	return true;
+
+    for( f = 0; f < 6; f++ ) {
+	if( !trk_nmea_isdigit( field[f] ) )
+	    return false;
+    }
+
+    date->day   = ( field[0] - '0' ) * 10 + ( field[1] - '0' );
+    date->month = ( field[2] - '0' ) * 10 + ( field[3] - '0' );
+    date->year  = ( field[4] - '0' ) * 10 + ( field[5] - '0' );
+
+    return true;
+}
+
+/* "T" */
+static inline bool trk_nmea_time( const char * field, struct minmea_time * time )
+{
+    int f, value, scale;
+
+    time->hours = time->minutes = time->seconds = time->microseconds = -1;
+
+    if( !trk_nmea_isfield( *field ) )
+	return true;
+
+    for( f = 0; f < 6; f++ ) {
+	if( !trk_nmea_isdigit( field[f] ) )
+	    return false;
+    }
+
+    time->hours   = ( field[0] - '0' ) * 10 + ( field[1] - '0' );
+    time->minutes = ( field[2] - '0' ) * 10 + ( field[3] - '0' );
+    time->seconds = ( field[4] - '0' ) * 10 + ( field[5] - '0' );
+    field += 6;
+
+    /* fraction in microseconds */
+    if( *field++ == '.' ) {
+	for( value = 0, scale = 1000000; trk_nmea_isdigit( *field ) && scale > 1; scale /= 10 )
+	    value = value * 10 + ( *field++ - '0' );
+	time->microseconds = value * scale;
+    } else {
+	time->microseconds = 0;
+    }
+
+    return true;
+}
+
+/* move to the next field, which must exist */
+#define NMEA_NEXT( field, p )				\
+    do {						\
+	if( !( ( field ) = trk_nmea_next( &( p ) ) ) )	\
+	    return false;				\
+    } while( 0 )
+
+static bool trk_nmea_parse_rmc( struct minmea_sentence_rmc * frame, const char * sentence )
+{
+    const char *p = sentence, *field = sentence;
+    int lat_dir, lon_dir, var_dir;
+    char validity;
+
+    if( !trk_nmea_type( field, "RMC" ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_time( field, &frame->time ) )
+	return false;
+    NMEA_NEXT( field, p );
+    validity = trk_nmea_char( field );
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->latitude ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_direction( field, &lat_dir ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->longitude ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_direction( field, &lon_dir ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->speed ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->course ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_date( field, &frame->date ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->variation ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_direction( field, &var_dir ) )
+	return false;
+
+    frame->valid = validity == 'A';
+    frame->latitude.value  *= lat_dir;
+    frame->longitude.value *= lon_dir;
+    frame->variation.value *= var_dir;
+
+    return true;
+}
+
+static bool trk_nmea_parse_gga( struct minmea_sentence_gga * frame, const char * sentence )
+{
+    const char *p = sentence, *field = sentence;
+    int lat_dir, lon_dir;
+
+    if( !trk_nmea_type( field, "GGA" ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_time( field, &frame->time ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->latitude ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_direction( field, &lat_dir ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->longitude ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_direction( field, &lon_dir ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_int( field, &frame->fix_quality ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_int( field, &frame->satellites_tracked ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->hdop ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->altitude ) )
+	return false;
+    NMEA_NEXT( field, p );
+    frame->altitude_units = trk_nmea_char( field );
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->height ) )
+	return false;
+    NMEA_NEXT( field, p );
+    frame->height_units = trk_nmea_char( field );
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_int( field, &frame->dgps_age ) )
+	return false;
+    /* trailing ignored field */
+    NMEA_NEXT( field, p );
+
+    frame->latitude.value  *= lat_dir;
+    frame->longitude.value *= lon_dir;
+
+    return true;
+}
+
+static bool trk_nmea_parse_gsa( struct minmea_sentence_gsa * frame, const char * sentence )
+{
+    const char *p = sentence, *field = sentence;
+    int i;
+
+    if( !trk_nmea_type( field, "GSA" ) )
+	return false;
+    NMEA_NEXT( field, p );
+    frame->mode = trk_nmea_char( field );
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_int( field, &frame->fix_type ) )
+	return false;
+    for( i = 0; i < 12; i++ ) {
+	NMEA_NEXT( field, p );
+	if( !trk_nmea_int( field, &frame->sats[i] ) )
+	    return false;
+    }
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->pdop ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->hdop ) )
+	return false;
+    NMEA_NEXT( field, p );
+    if( !trk_nmea_float( field, &frame->vdop ) )
+	return false;
+
+    return true;
+}
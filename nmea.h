@@ -12,10 +12,17 @@
 #define NMEA_H_INCLUDED
 
 
+#include <stddef.h>
+
 #include "track.h"
 
 
-int trk_parse_nmea( track_t track, void * data, size_t size );
+struct nmea_feed;
+
+
+int trk_parse_nmea( track_t track, const void * data, size_t size );
+
+void trk_nmea_feed_free( struct nmea_feed * feed );
 
 
 #endif
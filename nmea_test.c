@@ -0,0 +1,164 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * NMEA parsers test
+ *
+ */
+
+/*
+ * Differential test of the specialized RMC, GGA and GSA parsers: every
+ * sentence, valid or mutated, must give the same result and the same
+ * frame, bit for bit, as minmea_parse_rmc/gga/gsa().
+ *
+ * The parsers are static, so the parser source is included here.
+ */
+
+#include "nmea.c"
+
+#include <stdio.h>
+
+
+#define TEST_DEFAULT_ROUNDS 1000000
+
+/* longest mutated sentence */
+#define TEST_MAX_LENGTH 200
+
+
+static const char * const seeds[] = {
+    "$GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62",
+    "$GPRMC,100000.00,A,5544.9996,N,03736.6000,E,19.44,45.0,170520,,,A*6F",
+    "$GNRMC,225446.123456,V,4916.45,N,12311.12,W,000.5,054.7,191194,020.3,E",
+    "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47",
+    "$GPGGA,100000.00,5544.9996,N,03736.6000,E,1,09,1.2,150.0,M,14.0,M,,*6E",
+    "$GPGGA,,,,,,0,,,,,,,,",
+    "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39",
+    "$GNGSA,M,2,-04,+05, 7,09x,12,,,24,,,,,-2.5,+1.3, 2.1",
+};
+
+#define NSEEDS ( sizeof( seeds ) / sizeof( *seeds ) )
+
+/* characters the mutations insert: field syntax and likely troublemakers */
+static const char alphabet[] = "0123456789.,+- *$ANSEWMV\t\vx";
+
+
+static unsigned test_random( void );
+static size_t test_mutate( char * buf, size_t len );
+static int test_sentence( const char * sentence );
+
+
+
+int main( int argc, char **argv )
+{
+    char buf[TEST_MAX_LENGTH + 32];
+    long i, rounds = TEST_DEFAULT_ROUNDS;
+    size_t len;
+
+    if( argc > 1 )
+	rounds = atol( argv[1] );
+
+    for( i = 0; i < rounds; i++ ) {
+	len = strlen( seeds[i % NSEEDS] );
+	memcpy( buf, seeds[i % NSEEDS], len + 1 );
+
+	/* the seeds themselves first */
+	if( i >= ( long )NSEEDS )
+	    len = test_mutate( buf, len );
+	buf[len] = '\0';
+
+	if( !test_sentence( buf ) )
+	    return 1;
+    }
+
+    fprintf( stdout, "%ld sentences ok\n", rounds );
+
+    return 0;
+}
+
+
+/*
+ * xorshift64, for reproducible runs.
+ */
+static unsigned test_random( void )
+{
+    static uint64_t state = 88172645463325252ULL;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return ( unsigned )state;
+}
+
+/*
+ * Up to three random replacements, insertions, deletions or runs of
+ * digits long enough to overflow.
+ */
+static size_t test_mutate( char * buf, size_t len )
+{
+    unsigned n, k;
+    size_t pos;
+    char c;
+
+    n = test_random() % 4;
+
+    for( k = 0; k < n; k++ ) {
+	pos = len ? test_random() % len : 0;
+	c = alphabet[test_random() % ( sizeof( alphabet ) - 1 )];
+
+	switch( test_random() % 4 ) {
+	case 0:
+	    buf[pos] = c;
+	    break;
+	case 1:
+	    if( len < TEST_MAX_LENGTH ) {
+		memmove( buf + pos + 1, buf + pos, len - pos + 1 );
+		buf[pos] = c;
+		len++;
+	    }
+	    break;
+	case 2:
+	    if( len > 1 ) {
+		memmove( buf + pos, buf + pos + 1, len - pos );
+		len--;
+	    }
+	    break;
+	case 3:
+	    if( len + 20 <= TEST_MAX_LENGTH && test_random() % 8 == 0 ) {
+		memmove( buf + pos + 20, buf + pos, len - pos + 1 );
+		memset( buf + pos, '9', 20 );
+		len += 20;
+	    }
+	    break;
+	}
+    }
+
+    return len;
+}
+
+#define TEST_PARSER( type, sentence )					\
+    do {								\
+	struct minmea_sentence_##type expected, got;			\
+	bool ret_expected, ret_got;					\
+									\
+	memset( &expected, 0, sizeof( expected ) );			\
+	memset( &got, 0, sizeof( got ) );				\
+	ret_expected = minmea_parse_##type( &expected, sentence );	\
+	ret_got = trk_nmea_parse_##type( &got, sentence );		\
+	if( ret_expected != ret_got ||					\
+	    ( ret_expected && memcmp( &expected, &got, sizeof( got ) ) ) ) { \
+	    fprintf( stderr, #type " differs from minmea (%d, %d): '%s'\n", \
+		     ret_expected, ret_got, sentence );			\
+	    return 0;							\
+	}								\
+    } while( 0 )
+
+/*
+ * Every parser sees every sentence, so type mismatches are covered too.
+ */
+static int test_sentence( const char * sentence )
+{
+    TEST_PARSER( rmc, sentence );
+    TEST_PARSER( gga, sentence );
+    TEST_PARSER( gsa, sentence );
+
+    return 1;
+}
@@ -0,0 +1,209 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, number parser.
+ *
+ */
+
+/**
+ * @file number.c Number parser implementation.
+ *
+ * Numbers are read from (pointer, length) slices, so values can be
+ * parsed where they lie in the input. Parsing does not depend on the
+ * locale.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "number.h"
+
+
+/* significant digits that always fit in uint64_t */
+#define NUMBER_MAX_DIGITS 19
+
+/* longest number taking the strtod() path */
+#define NUMBER_MAX_LENGTH 768
+
+/* exponents beyond this over- or underflow anyway */
+#define NUMBER_MAX_EXP 100000
+
+
+static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+
+static int trk_parse_double_slow( const char * str,
+				  const char * end,
+				  int          neg,
+				  int          exp10,
+				  double     * value );
+
+
+
+static inline int trk_isspace( char c )
+{
+    return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+static inline int trk_isdigit( char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+/*
+ * Parse [sign] digits [. digits] [(e|E) [sign] digits], white space
+ * around allowed. Up to 19 significant digits with a power of ten
+ * within 1e22 are converted exactly with a single floating point
+ * operation, anything else through strtod().
+ */
+int trk_parse_double( const char * str, size_t len, double * value )
+{
+    const char *p = str, *end = str + len, *digits;
+    uint64_t w = 0;
+    int neg = 0, any = 0, inexact = 0, nd = 0, exp10 = 0, e = 0, eneg = 0;
+    double v;
+
+    while( p < end && trk_isspace( *p ) )
+	p++;
+    while( end > p && trk_isspace( end[-1] ) )
+	end--;
+
+    if( p < end && ( *p == '+' || *p == '-' ) )
+	neg = *p++ == '-';
+
+    digits = p;
+
+    for( ; p < end && trk_isdigit( *p ); p++ ) {
+	any = 1;
+	if( nd < NUMBER_MAX_DIGITS ) {
+	    w = w * 10 + ( *p - '0' );
+	    nd += w != 0;
+	} else {
+	    exp10++;
+	    inexact |= *p != '0';
+	}
+    }
+
+    if( p < end && *p == '.' ) {
+	for( p++; p < end && trk_isdigit( *p ); p++ ) {
+	    any = 1;
+	    if( nd < NUMBER_MAX_DIGITS ) {
+		w = w * 10 + ( *p - '0' );
+		nd += w != 0;
+		exp10--;
+	    } else {
+		inexact |= *p != '0';
+	    }
+	}
+    }
+
+    if( !any )
+	return 0;
+
+    if( p < end && ( *p == 'e' || *p == 'E' ) ) {
+	p++;
+	if( p < end && ( *p == '+' || *p == '-' ) )
+	    eneg = *p++ == '-';
+	if( p == end || !trk_isdigit( *p ) )
+	    return 0;
+	for( ; p < end && trk_isdigit( *p ); p++ ) {
+	    if( e < NUMBER_MAX_EXP )
+		e = e * 10 + ( *p - '0' );
+	}
+	exp10 += eneg ? -e : e;
+    }
+
+    if( p != end )
+	return 0;
+
+    if( inexact || w > ( 1ULL << 53 ) || exp10 < -22 || exp10 > 22 )
+	return trk_parse_double_slow( digits, end, neg, eneg ? -e : e, value );
+
+    v = ( double )w;
+    if( exp10 > 0 )
+	v *= pow10[exp10];
+    else if( exp10 < 0 )
+	v /= pow10[-exp10];
+
+    *value = neg ? -v : v;
+
+    return 1;
+}
+
+/*
+ * Parse [sign] digits, white space around allowed.
+ */
+int trk_parse_int( const char * str, size_t len, int * value )
+{
+    const char *p = str, *end = str + len;
+    long v = 0;
+    int neg = 0;
+
+    while( p < end && trk_isspace( *p ) )
+	p++;
+    while( end > p && trk_isspace( end[-1] ) )
+	end--;
+
+    if( p < end && ( *p == '+' || *p == '-' ) )
+	neg = *p++ == '-';
+
+    if( p == end )
+	return 0;
+
+    for( ; p < end; p++ ) {
+	if( !trk_isdigit( *p ) )
+	    return 0;
+	v = v * 10 + ( *p - '0' );
+	if( v > ( long )INT_MAX + 1 )
+	    return 0;
+    }
+
+    if( !neg && v > INT_MAX )
+	return 0;
+
+    *value = ( int )( neg ? -v : v );
+
+    return 1;
+}
+
+
+/*
+ * Hand the digits to strtod() as "digits" "e" exponent: without a
+ * decimal point the locale plays no part.
+ */
+static int trk_parse_double_slow( const char * str,
+				  const char * end,
+				  int          neg,
+				  int          exp10,
+				  double     * value )
+{
+    char buf[NUMBER_MAX_LENGTH + 16], *q = buf;
+    const char *p;
+    double v;
+
+    if( end - str > NUMBER_MAX_LENGTH )
+	return 0;
+
+    for( p = str; p < end && trk_isdigit( *p ); p++ )
+	*q++ = *p;
+
+    if( p < end && *p == '.' ) {
+	for( p++; p < end && trk_isdigit( *p ); p++ ) {
+	    *q++ = *p;
+	    exp10--;
+	}
+    }
+
+    q += sprintf( q, "e%d", exp10 );
+
+    v = strtod( buf, NULL );
+
+    *value = neg ? -v : v;
+
+    return 1;
+}
@@ -0,0 +1,23 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, number parser.
+ *
+ */
+
+/**
+ * @file number.h Number parser header.
+ */
+
+#ifndef NUMBER_H_INCLUDED
+#define NUMBER_H_INCLUDED
+
+
+#include <stddef.h>
+
+
+int trk_parse_double( const char * str, size_t len, double * value );
+
+int trk_parse_int( const char * str, size_t len, int * value );
+
+
+#endif
@@ -1,59 +1,981 @@
 /* -*- Mode: C; c-basic-offset: 4; -*-
  *
- * Track point.
+ * Track points.
  *
  */
 
 /**
- * @file point.c Track point.
+ * @file point.c Track points column store.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
 #include <assert.h>
+#include <math.h>
+#include <sys/mman.h>
 
 #include "point.h"
 
 
+#define POINTS_MIN_CAPACITY 64
 
-point_t trk_point_make( time_t  time,
-			double  latitude,
-			double  longitude,
-			double  altitude,
-			double  azimuth,
-			double  speed,
-			int     nsat,
-			int     fix_type,
-			double  hdop,
-			double  vdop,
-			double  pdop )
+/* size of the largest column element */
+#define POINTS_MAX_SIZE sizeof( double )
+
+
+struct points_column {
+    size_t offset;
+    size_t size;
+};
+
+#define POINTS_COLUMN( member )						\
+    { offsetof( struct points_o, member ), sizeof( *( ( struct points_o * )0 )->member ) }
+
+static const struct points_column points_columns[] = {
+    POINTS_COLUMN( time ),
+    POINTS_COLUMN( latitude ),
+    POINTS_COLUMN( longitude ),
+    POINTS_COLUMN( altitude ),
+    POINTS_COLUMN( azimuth ),
+    POINTS_COLUMN( speed ),
+    POINTS_COLUMN( nsat ),
+    POINTS_COLUMN( fix_type ),
+    POINTS_COLUMN( hdop ),
+    POINTS_COLUMN( vdop ),
+    POINTS_COLUMN( pdop ),
+    /* segment cache, not part of the points themselves */
+    POINTS_COLUMN( seg_length ),
+    POINTS_COLUMN( seg_azimuth ),
+    POINTS_COLUMN( seg_speed ),
+};
+
+#define POINTS_NCOLUMNS     11
+#define POINTS_NSEG_COLUMNS 3
+
+static const struct points_column points_compact_columns[] = {
+    POINTS_COLUMN( time_ms ),
+    POINTS_COLUMN( latitude_e7 ),
+    POINTS_COLUMN( longitude_e7 ),
+    POINTS_COLUMN( altitude_cm ),
+    POINTS_COLUMN( azimuth_e2 ),
+    POINTS_COLUMN( speed_cm ),
+    POINTS_COLUMN( nsat_e0 ),
+    POINTS_COLUMN( fix_type_e0 ),
+    POINTS_COLUMN( hdop_e1 ),
+    POINTS_COLUMN( vdop_e1 ),
+    POINTS_COLUMN( pdop_e1 ),
+};
+
+#define POINTS_NCOMPACT_COLUMNS ( sizeof( points_compact_columns ) / sizeof( *points_compact_columns ) )
+
+
+static const struct points_column * trk_points_columns( const struct points_o * points,
+							 size_t                * n,
+							 size_t                * nseg );
+static void ** trk_points_column( points_t points, const struct points_column * column );
+static int trk_points_resize( points_t points, size_t capacity );
+static int trk_points_unmap( points_t points, size_t capacity );
+static int trk_points_resize_column( void ** column, size_t size );
+static int trk_points_append_compact( points_t points,
+				      int64_t  time,
+				      double   latitude,
+				      double   longitude,
+				      double   altitude,
+				      double   azimuth,
+				      double   speed,
+				      int      nsat,
+				      int      fix_type,
+				      double   hdop,
+				      double   vdop,
+				      double   pdop );
+static int32_t trk_points_encode_i32( double value, double scale );
+static uint16_t trk_points_encode_u16( double value, double scale );
+static uint16_t trk_points_encode_azimuth( double azimuth );
+static uint8_t trk_points_encode_u8( double value, double scale );
+static void trk_points_geodesic( const struct points_o      * points,
+				 const struct geod_geodesic * g,
+				 size_t                       i,
+				 double                     * length,
+				 double                     * azimuth,
+				 double                     * speed );
+static void trk_points_permute( void         * column,
+				size_t         size,
+				const size_t * order,
+				size_t         count,
+				void         * scratch );
+static void trk_points_move( points_t points, size_t dst, size_t src );
+static void trk_points_merge( points_t points, size_t dst, size_t src );
+
+
+
+void trk_points_init( points_t points )
+{
+    size_t i;
+
+    assert( points );
+
+    for( i = 0; i < POINTS_NCOLUMNS + POINTS_NSEG_COLUMNS; i++ )
+	*trk_points_column( points, &points_columns[i] ) = NULL;
+    for( i = 0; i < POINTS_NCOMPACT_COLUMNS; i++ )
+	*trk_points_column( points, &points_compact_columns[i] ) = NULL;
+
+    points->compact   = 0;
+    points->origin    = 0;
+    points->map       = NULL;
+    points->map_size  = 0;
+    points->count     = 0;
+    points->capacity  = 0;
+}
+
+/*
+ * Release the columns; the store stays compact if it was.
+ */
+void trk_points_free( points_t points )
+{
+    size_t i;
+    int compact;
+
+    if( !points )
+	return;
+
+    if( points->map ) {
+	munmap( points->map, points->map_size );
+    } else {
+	for( i = 0; i < POINTS_NCOLUMNS + POINTS_NSEG_COLUMNS; i++ )
+	    free( *trk_points_column( points, &points_columns[i] ) );
+	for( i = 0; i < POINTS_NCOMPACT_COLUMNS; i++ )
+	    free( *trk_points_column( points, &points_compact_columns[i] ) );
+    }
+
+    compact = points->compact;
+    trk_points_init( points );
+    points->compact = compact;
+}
+
+/*
+ * Switch an empty store to or from the compact encoding: times rounded
+ * to milliseconds within 24 days of the first point, coordinates at
+ * 1e-7 degree, altitude at 1 cm, speed at 1 cm/s up to 655 m/s,
+ * azimuth at 0.01 degree and DOP at 0.1 up to 25.4. Compact stores
+ * have no segment cache; segments are computed when needed.
+ */
+int trk_points_set_compact( points_t points, int compact )
+{
+    assert( points );
+
+    if( points->count ) {
+	errno = EBUSY;
+	return 0;
+    }
+
+    trk_points_free( points );
+    points->compact = compact != 0;
+
+    return 1;
+}
+
+/*
+ * Point columns followed by the segment cache ones; the order is part
+ * of the snapshot format.
+ */
+size_t trk_points_ncolumns( const struct points_o * points )
+{
+    size_t n, nseg;
+
+    assert( points );
+
+    trk_points_columns( points, &n, &nseg );
+
+    return n + nseg;
+}
+
+const void * trk_points_column_data( const struct points_o * points,
+				     size_t                  k,
+				     size_t                * size )
+{
+    const struct points_column *columns;
+    size_t n, nseg;
+
+    assert( points );
+
+    columns = trk_points_columns( points, &n, &nseg );
+    assert( k < n + nseg );
+
+    *size = columns[k].size;
+
+    return *trk_points_column( ( points_t )points, &columns[k] );
+}
+
+/*
+ * Copy the element of the last point in column k to last. The segment
+ * cache slot of the last point is unused and given as NaN without
+ * reading it: a live writer fills it while readers hold the point.
+ */
+void trk_points_column_last( const struct points_o * points,
+			     size_t                  k,
+			     void                  * last )
+{
+    static const double unset = NAN;
+    const struct points_column *columns;
+    const char *data;
+    size_t n, nseg;
+
+    assert( points && points->count );
+
+    columns = trk_points_columns( points, &n, &nseg );
+    assert( k < n + nseg );
+
+    if( k >= n ) {
+	assert( columns[k].size == sizeof( unset ) );
+	memcpy( last, &unset, sizeof( unset ) );
+	return;
+    }
+
+    data = *trk_points_column( ( points_t )points, &columns[k] );
+    memcpy( last, data + ( points->count - 1 ) * columns[k].size, columns[k].size );
+}
+
+/*
+ * Element size of column k of the given encoding, 0 if there is none.
+ */
+size_t trk_points_column_size( int compact, size_t k )
+{
+    if( compact )
+	return k < POINTS_NCOMPACT_COLUMNS ? points_compact_columns[k].size : 0;
+
+    return k < POINTS_NCOLUMNS + POINTS_NSEG_COLUMNS ? points_columns[k].size : 0;
+}
+
+/*
+ * Make an empty store use columns in a private mapping, which the store
+ * unmaps when freed. Columns are given in trk_points_ncolumns() order.
+ */
+void trk_points_attach( points_t       points,
+			void         * map,
+			size_t         map_size,
+			int            compact,
+			int64_t        origin,
+			size_t         count,
+			void * const * columns )
+{
+    const struct points_column *table;
+    size_t i, n, nseg;
+
+    assert( points && points->count == 0 );
+
+    trk_points_free( points );
+
+    points->compact = compact != 0;
+
+    table = trk_points_columns( points, &n, &nseg );
+    for( i = 0; i < n + nseg; i++ )
+	*trk_points_column( points, &table[i] ) = columns[i];
+
+    points->origin   = origin;
+    points->map      = map;
+    points->map_size = map_size;
+    points->count    = count;
+    points->capacity = count;
+}
+
+int trk_points_reserve( points_t points, size_t capacity )
+{
+    assert( points );
+
+    if( capacity <= points->capacity )
+	return 1;
+
+    return trk_points_resize( points, capacity );
+}
+
+/*
+ * Move the points to new heap columns of given capacity, or of the next
+ * growth step if 0. The previous columns are handed over in old rather
+ * than released, for readers that may still use them; free them with
+ * trk_points_free().
+ */
+int trk_points_relocate( points_t points, size_t capacity, points_t old )
+{
+    const struct points_column *columns;
+    void *copies[POINTS_NCOLUMNS + POINTS_NSEG_COLUMNS];
+    size_t i, n, nseg;
+
+    assert( points && old );
+
+    if( capacity == 0 )
+	capacity = points->capacity ? points->capacity * 2 : POINTS_MIN_CAPACITY;
+    assert( capacity >= points->count );
+
+    columns = trk_points_columns( points, &n, &nseg );
+
+    for( i = 0; i < n + nseg; i++ ) {
+	copies[i] = malloc( capacity * columns[i].size );
+	if( !copies[i] ) {
+	    while( i-- )
+		free( copies[i] );
+	    return 0;
+	}
+	if( points->count )
+	    memcpy( copies[i], *trk_points_column( points, &columns[i] ),
+		    points->count * columns[i].size );
+    }
+
+    *old = *points;
+
+    points->map = NULL;
+    points->map_size = 0;
+
+    for( i = 0; i < n + nseg; i++ )
+	*trk_points_column( points, &columns[i] ) = copies[i];
+
+    points->capacity = capacity;
+
+    return 1;
+}
+
+/*
+ * Bytes taken by the columns.
+ */
+size_t trk_points_memory( const struct points_o * points )
+{
+    const struct points_column *columns;
+    size_t i, n, nseg, size = 0;
+
+    assert( points );
+
+    if( points->map )
+	return points->map_size;
+
+    columns = trk_points_columns( points, &n, &nseg );
+    for( i = 0; i < n + nseg; i++ )
+	size += columns[i].size;
+
+    return size * points->capacity;
+}
+
+/*
+ * Release unused capacity.
+ */
+void trk_points_shrink( points_t points )
+{
+    assert( points );
+
+    if( points->count == 0 || points->count == points->capacity || points->map )
+	return;
+
+    /* on failure the store simply keeps its larger columns */
+    trk_points_resize( points, points->count );
+}
+
+int trk_points_append( points_t points,
+		       int64_t  time,
+		       double   latitude,
+		       double   longitude,
+		       double   altitude,
+		       double   azimuth,
+		       double   speed,
+		       int      nsat,
+		       int      fix_type,
+		       double   hdop,
+		       double   vdop,
+		       double   pdop )
+{
+    size_t i;
+
+    assert( points );
+
+    if( points->count == points->capacity ) {
+	if( !trk_points_reserve( points, points->capacity ?
+				 points->capacity * 2 : POINTS_MIN_CAPACITY ) )
+	    return 0;
+    }
+
+    if( points->compact )
+	return trk_points_append_compact( points, time, latitude, longitude,
+					  altitude, azimuth, speed, nsat,
+					  fix_type, hdop, vdop, pdop );
+
+    i = points->count++;
+
+    points->time[i]      = time;
+    points->latitude[i]  = latitude;
+    points->longitude[i] = longitude;
+    points->altitude[i]  = altitude;
+    points->azimuth[i]   = azimuth;
+    points->speed[i]     = speed;
+    points->nsat[i]      = nsat;
+    points->fix_type[i]  = fix_type;
+    points->hdop[i]      = hdop;
+    points->vdop[i]      = vdop;
+    points->pdop[i]      = pdop;
+
+    return 1;
+}
+
+/*
+ * Append points [from, count) of another store.
+ */
+int trk_points_append_points( points_t                points,
+			      const struct points_o * src,
+			      size_t                  from )
+{
+    const struct points_column *columns;
+    size_t i, k, n, ncolumns;
+    void *column;
+
+    assert( points && src );
+
+    if( from >= src->count )
+	return 1;
+
+    /* different encodings are converted point by point */
+    if( points->compact != src->compact ||
+	( points->compact && points->count && points->origin != src->origin ) ) {
+	for( i = from; i < src->count; i++ ) {
+	    if( !trk_points_append( points,
+				    trk_point_time( src, i ),
+				    trk_point_latitude( src, i ),
+				    trk_point_longitude( src, i ),
+				    trk_point_altitude( src, i ),
+				    trk_point_azimuth( src, i ),
+				    trk_point_speed( src, i ),
+				    trk_point_nsat( src, i ),
+				    trk_point_fix_type( src, i ),
+				    trk_point_hdop( src, i ),
+				    trk_point_vdop( src, i ),
+				    trk_point_pdop( src, i ) ) )
+		return 0;
+	}
+	return 1;
+    }
+
+    n = src->count - from;
+
+    if( points->count + n > points->capacity ) {
+	if( !trk_points_reserve( points, points->count + n > points->capacity * 2 ?
+				 points->count + n : points->capacity * 2 ) )
+	    return 0;
+    }
+
+    i = points->count;
+    if( i == 0 )
+	points->origin = src->origin;
+
+    columns = trk_points_columns( points, &ncolumns, NULL );
+    for( k = 0; k < ncolumns; k++ ) {
+	column = *trk_points_column( points, &columns[k] );
+	memcpy( ( char * )column + i * columns[k].size,
+		( const char * )*trk_points_column( ( points_t )src, &columns[k] ) +
+		from * columns[k].size,
+		n * columns[k].size );
+    }
+
+    points->count += n;
+
+    return 1;
+}
+
+
+/*
+ * Sort points by time with a stable LSD radix sort on the time offset
+ * from the earliest point; byte passes that can not change the order
+ * are skipped. Already ordered stores (the usual case) are detected in
+ * a single pass and left untouched.
+ */
+int trk_points_sort( points_t points )
+{
+    const struct points_column *columns;
+    uint64_t *keys_buf, *keys, *keys_tmp, *swap_keys, range;
+    size_t *order_buf, *order, *order_tmp, *swap_order;
+    size_t counts[256], offset, c, i, n, ncolumns;
+    int64_t min, max, t;
+    unsigned shift, digit;
+    void *scratch;
+
+    assert( points );
+
+    n = points->count;
+
+    for( i = 1; i < n; i++ ) {
+	if( trk_point_time( points, i ) < trk_point_time( points, i - 1 ) )
+	    break;
+    }
+    if( i >= n )
+	return 1;
+
+    keys_buf = malloc( 2 * n * sizeof( *keys_buf ) );
+    order_buf = malloc( 2 * n * sizeof( *order_buf ) );
+    scratch = malloc( n * POINTS_MAX_SIZE );
+    if( !keys_buf || !order_buf || !scratch ) {
+	free( keys_buf );
+	free( order_buf );
+	free( scratch );
+	return 0;
+    }
+    keys = keys_buf;
+    keys_tmp = keys_buf + n;
+    order = order_buf;
+    order_tmp = order_buf + n;
+
+    min = max = trk_point_time( points, 0 );
+    for( i = 1; i < n; i++ ) {
+	t = trk_point_time( points, i );
+	if( t < min )
+	    min = t;
+	if( t > max )
+	    max = t;
+    }
+    range = ( uint64_t )max - ( uint64_t )min;
+
+    for( i = 0; i < n; i++ ) {
+	keys[i] = ( uint64_t )trk_point_time( points, i ) - ( uint64_t )min;
+	order[i] = i;
+    }
+
+    for( shift = 0; shift < 64 && ( range >> shift ); shift += 8 ) {
+	memset( counts, 0, sizeof( counts ) );
+
+	for( i = 0; i < n; i++ )
+	    counts[( keys[i] >> shift ) & 0xff]++;
+
+	if( counts[( keys[0] >> shift ) & 0xff] == n )
+	    continue;
+
+	for( digit = 0, offset = 0; digit < 256; digit++ ) {
+	    c = counts[digit];
+	    counts[digit] = offset;
+	    offset += c;
+	}
+
+	for( i = 0; i < n; i++ ) {
+	    c = counts[( keys[i] >> shift ) & 0xff]++;
+	    keys_tmp[c] = keys[i];
+	    order_tmp[c] = order[i];
+	}
+
+	swap_keys = keys; keys = keys_tmp; keys_tmp = swap_keys;
+	swap_order = order; order = order_tmp; order_tmp = swap_order;
+    }
+
+    columns = trk_points_columns( points, &ncolumns, NULL );
+    for( i = 0; i < ncolumns; i++ )
+	trk_points_permute( *trk_points_column( points, &columns[i] ), columns[i].size,
+			    order, n, scratch );
+
+    free( keys_buf );
+    free( order_buf );
+    free( scratch );
+
+    return 1;
+}
+
+/*
+ * Drop points without position and merge points sharing a time into
+ * the first of them, filling its missing attributes from the others.
+ * The store must be sorted by time. Returns number of removed points.
+ */
+size_t trk_points_compact( points_t points )
 {
-    point_t point;
+    size_t i, j, n;
 
-    point = malloc( sizeof( *point ) );
-    if( !point )
-	return NULL;
+    assert( points );
 
-    point->time      = time;
-    point->latitude  = latitude;
-    point->longitude = longitude;
-    point->altitude  = altitude;
-    point->azimuth   = azimuth;
-    point->speed     = speed;
-    point->nsat      = nsat;
-    point->fix_type  = fix_type;
-    point->hdop      = hdop;
-    point->vdop      = vdop;
-    point->pdop      = pdop;
+    n = points->count;
 
-    return point;
+    for( i = 0, j = 0; i < n; i++ ) {
+	if( isnan( trk_point_latitude( points, i ) ) ||
+	    isnan( trk_point_longitude( points, i ) ) )
+	    continue;
+
+	if( j > 0 && trk_point_time( points, j - 1 ) == trk_point_time( points, i ) ) {
+	    trk_points_merge( points, j - 1, i );
+	    continue;
+	}
+
+	if( i != j )
+	    trk_points_move( points, j, i );
+	j++;
+    }
+
+    points->count = j;
+
+    return n - j;
 }
 
-void trk_point_free( point_t point )
+/*
+ * Fill the segment cache for segments starting at points from - 1 onward.
+ * Compact stores have no cache.
+ */
+void trk_points_update_segments( points_t                     points,
+				 const struct geod_geodesic * g,
+				 size_t                       from )
 {
-    if( !point )
+    size_t i;
+
+    assert( points );
+    assert( g );
+
+    if( points->compact )
 	return;
 
-    free( point );
+    if( from > 0 )
+	from--;
+
+    for( i = from; i + 1 < points->count; i++ )
+	trk_points_geodesic( points, g, i,
+			     &points->seg_length[i],
+			     &points->seg_azimuth[i],
+			     &points->seg_speed[i] );
+
+    /* keep the unused last slot defined, snapshots write it out */
+    if( points->count ) {
+	i = points->count - 1;
+	points->seg_length[i]  = NAN;
+	points->seg_azimuth[i] = NAN;
+	points->seg_speed[i]   = NAN;
+    }
+}
+
+/*
+ * Geodesic from point i to point i + 1, from the cache when there is
+ * one. Any of length, azimuth and speed may be NULL.
+ */
+void trk_points_segment( const struct points_o      * points,
+			 const struct geod_geodesic * g,
+			 size_t                       i,
+			 double                     * length,
+			 double                     * azimuth,
+			 double                     * speed )
+{
+    double s12, az1, spd;
+
+    assert( points );
+    assert( i + 1 < points->count );
+
+    if( points->compact ) {
+	trk_points_geodesic( points, g, i, &s12, &az1, &spd );
+    } else {
+	s12 = points->seg_length[i];
+	az1 = points->seg_azimuth[i];
+	spd = points->seg_speed[i];
+    }
+
+    if( length )
+	*length = s12;
+    if( azimuth )
+	*azimuth = az1;
+    if( speed )
+	*speed = spd;
 }
 
+/*
+ * Index of the first point at or after given time (count if none).
+ * The store must be sorted by time.
+ */
+size_t trk_points_lower_bound( const struct points_o * points, int64_t time )
+{
+    size_t lo, hi, mid;
+
+    assert( points );
+
+    lo = 0;
+    hi = points->count;
+
+    while( lo < hi ) {
+	mid = lo + ( hi - lo ) / 2;
+
+	if( trk_point_time( points, mid ) < time )
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+
+/*
+ * Columns of the store encoding: n point columns followed by nseg
+ * segment cache columns.
+ */
+static const struct points_column * trk_points_columns( const struct points_o * points,
+							 size_t                * n,
+							 size_t                * nseg )
+{
+    if( points->compact ) {
+	*n = POINTS_NCOMPACT_COLUMNS;
+	if( nseg )
+	    *nseg = 0;
+	return points_compact_columns;
+    }
+
+    *n = POINTS_NCOLUMNS;
+    if( nseg )
+	*nseg = POINTS_NSEG_COLUMNS;
+    return points_columns;
+}
+
+static void ** trk_points_column( points_t points, const struct points_column * column )
+{
+    return ( void ** )( ( char * )points + column->offset );
+}
+
+/*
+ * Columns are resized one by one; a failure leaves the already resized
+ * columns valid, so the store stays consistent. Never called with
+ * a capacity below the point count.
+ */
+static int trk_points_resize( points_t points, size_t capacity )
+{
+    const struct points_column *columns;
+    size_t i, n, nseg;
+
+    if( points->map )
+	return trk_points_unmap( points, capacity );
+
+    columns = trk_points_columns( points, &n, &nseg );
+
+    for( i = 0; i < n + nseg; i++ ) {
+	if( !trk_points_resize_column( trk_points_column( points, &columns[i] ),
+				       capacity * columns[i].size ) )
+	    return 0;
+    }
+
+    points->capacity = capacity;
+
+    return 1;
+}
+
+/*
+ * Copy the columns of an attached store to the heap.
+ */
+static int trk_points_unmap( points_t points, size_t capacity )
+{
+    struct points_o old;
+
+    if( !trk_points_relocate( points, capacity, &old ) )
+	return 0;
+
+    trk_points_free( &old );
+
+    return 1;
+}
+
+
+static int trk_points_resize_column( void ** column, size_t size )
+{
+    void *ptr;
+
+    ptr = realloc( *column, size );
+    if( !ptr )
+	return 0;
+
+    *column = ptr;
+
+    return 1;
+}
+
+static void trk_points_permute( void         * column,
+				size_t         size,
+				const size_t * order,
+				size_t         count,
+				void         * scratch )
+{
+    size_t i;
+
+    for( i = 0; i < count; i++ )
+	memcpy( ( char * )scratch + i * size,
+		( const char * )column + order[i] * size,
+		size );
+
+    memcpy( column, scratch, count * size );
+}
+
+static void trk_points_move( points_t points, size_t dst, size_t src )
+{
+    const struct points_column *columns;
+    size_t i, n;
+    char *column;
+
+    columns = trk_points_columns( points, &n, NULL );
+
+    for( i = 0; i < n; i++ ) {
+	column = *trk_points_column( points, &columns[i] );
+	memcpy( column + dst * columns[i].size,
+		column + src * columns[i].size,
+		columns[i].size );
+    }
+}
+
+static void trk_points_merge( points_t points, size_t dst, size_t src )
+{
+    if( points->compact ) {
+	if( points->altitude_cm[dst] == POINTS_UNSET_I32 )
+	    points->altitude_cm[dst] = points->altitude_cm[src];
+	if( points->azimuth_e2[dst] == POINTS_UNSET_U16 )
+	    points->azimuth_e2[dst] = points->azimuth_e2[src];
+	if( points->speed_cm[dst] == POINTS_UNSET_U16 )
+	    points->speed_cm[dst] = points->speed_cm[src];
+	if( points->nsat_e0[dst] == POINTS_UNSET_U8 )
+	    points->nsat_e0[dst] = points->nsat_e0[src];
+	if( points->fix_type_e0[dst] < 0 )
+	    points->fix_type_e0[dst] = points->fix_type_e0[src];
+	if( points->hdop_e1[dst] == POINTS_UNSET_U8 )
+	    points->hdop_e1[dst] = points->hdop_e1[src];
+	if( points->vdop_e1[dst] == POINTS_UNSET_U8 )
+	    points->vdop_e1[dst] = points->vdop_e1[src];
+	if( points->pdop_e1[dst] == POINTS_UNSET_U8 )
+	    points->pdop_e1[dst] = points->pdop_e1[src];
+	return;
+    }
+
+    if( isnan( points->altitude[dst] ) )
+	points->altitude[dst] = points->altitude[src];
+    if( isnan( points->azimuth[dst] ) )
+	points->azimuth[dst] = points->azimuth[src];
+    if( isnan( points->speed[dst] ) )
+	points->speed[dst] = points->speed[src];
+    if( points->nsat[dst] < 0 )
+	points->nsat[dst] = points->nsat[src];
+    if( points->fix_type[dst] < 0 )
+	points->fix_type[dst] = points->fix_type[src];
+    if( isnan( points->hdop[dst] ) )
+	points->hdop[dst] = points->hdop[src];
+    if( isnan( points->vdop[dst] ) )
+	points->vdop[dst] = points->vdop[src];
+    if( isnan( points->pdop[dst] ) )
+	points->pdop[dst] = points->pdop[src];
+}
+
+/*
+ * Append to a compact store with room for the point. The first point
+ * sets the time origin; points more than 24 days away from it fail
+ * with ERANGE.
+ */
+static int trk_points_append_compact( points_t points,
+				      int64_t  time,
+				      double   latitude,
+				      double   longitude,
+				      double   altitude,
+				      double   azimuth,
+				      double   speed,
+				      int      nsat,
+				      int      fix_type,
+				      double   hdop,
+				      double   vdop,
+				      double   pdop )
+{
+    int64_t ms;
+    size_t i;
+
+    if( points->count == 0 )
+	points->origin = time;
+
+    ms = time - points->origin;
+    ms = ( ms >= 0 ? ms + 500000 : ms - 500000 ) / 1000000;
+    if( ms < -INT32_MAX || ms > INT32_MAX ) {
+	errno = ERANGE;
+	return 0;
+    }
+
+    i = points->count++;
+
+    points->time_ms[i]      = ( int32_t )ms;
+    points->latitude_e7[i]  = trk_points_encode_i32( latitude, 1e7 );
+    points->longitude_e7[i] = trk_points_encode_i32( longitude, 1e7 );
+    points->altitude_cm[i]  = trk_points_encode_i32( altitude, 1e2 );
+    points->azimuth_e2[i]   = trk_points_encode_azimuth( azimuth );
+    points->speed_cm[i]     = trk_points_encode_u16( speed, 1e2 );
+    points->nsat_e0[i]      = nsat < 0 ? POINTS_UNSET_U8 :
+	nsat < POINTS_UNSET_U8 ? ( uint8_t )nsat : POINTS_UNSET_U8 - 1;
+    points->fix_type_e0[i]  = fix_type < 0 ? -1 : fix_type < INT8_MAX ? ( int8_t )fix_type : INT8_MAX;
+    points->hdop_e1[i]      = trk_points_encode_u8( hdop, 1e1 );
+    points->vdop_e1[i]      = trk_points_encode_u8( vdop, 1e1 );
+    points->pdop_e1[i]      = trk_points_encode_u8( pdop, 1e1 );
+
+    return 1;
+}
+
+/*
+ * Values out of range are stored as unset.
+ */
+static int32_t trk_points_encode_i32( double value, double scale )
+{
+    value = round( value * scale );
+
+    if( !( value > INT32_MIN && value <= INT32_MAX ) )
+	return POINTS_UNSET_I32;
+
+    return ( int32_t )value;
+}
+
+/*
+ * Values above the range are clamped to its top.
+ */
+static uint16_t trk_points_encode_u16( double value, double scale )
+{
+    value = round( value * scale );
+
+    if( !( value >= 0. ) )
+	return POINTS_UNSET_U16;
+
+    return value < POINTS_UNSET_U16 ? ( uint16_t )value : POINTS_UNSET_U16 - 1;
+}
+
+/*
+ * Azimuths are normalized to [0, 360) in 0.01 degree steps; those
+ * rounding up to 360 wrap to 0.
+ */
+static uint16_t trk_points_encode_azimuth( double azimuth )
+{
+    if( !isfinite( azimuth ) )
+	return POINTS_UNSET_U16;
+
+    azimuth = fmod( azimuth, 360. );
+    if( azimuth < 0. )
+	azimuth += 360.;
+
+    return ( uint16_t )( ( long )round( azimuth * 1e2 ) % 36000 );
+}
+
+/*
+ * Values above the range are clamped to its top.
+ */
+static uint8_t trk_points_encode_u8( double value, double scale )
+{
+    value = round( value * scale );
+
+    if( !( value >= 0. ) )
+	return POINTS_UNSET_U8;
+
+    return value < POINTS_UNSET_U8 ? ( uint8_t )value : POINTS_UNSET_U8 - 1;
+}
+
+/*
+ * Azimuths are normalized to [0, 360).
+ */
+static void trk_points_geodesic( const struct points_o      * points,
+				 const struct geod_geodesic * g,
+				 size_t                       i,
+				 double                     * length,
+				 double                     * azimuth,
+				 double                     * speed )
+{
+    double s12, az1, az2, dt;
+
+    geod_inverse( g, trk_point_latitude( points, i ), trk_point_longitude( points, i ),
+		  trk_point_latitude( points, i + 1 ), trk_point_longitude( points, i + 1 ),
+		  &s12, &az1, &az2 );
+
+    if( az1 < 0. )
+	az1 += 360.;
+
+    dt = ( double )( trk_point_time( points, i + 1 ) - trk_point_time( points, i ) ) * 1e-9;
+
+    *length  = s12;
+    *azimuth = az1;
+    *speed   = dt > 0. ? s12 / dt : NAN;
+}
@@ -1,51 +1,230 @@
 /* -*- Mode: C; c-basic-offset: 4; -*-
  *
- * Track point.
+ * Track points.
  *
  */
 
 /**
- * @file point.h Track point header.
+ * @file point.h Track points header.
  */
 
 #ifndef POINT_H_INCLUDED
 #define POINT_H_INCLUDED
 
 
-#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
 
+#include "geodesic.h"
 
-typedef struct point_o * point_t;
 
-struct point_o {
-    time_t   time;
-    double   latitude;
-    double   longitude;
-    double   altitude;
-    double   azimuth;
-    double   speed;
-    int      nsat;
-    int      fix_type;
-    double   hdop;
-    double   vdop;
-    double   pdop;
+typedef struct points_o * points_t;
+
+/*
+ * Column store: one array per point attribute, all indexed by point number.
+ * Times are nanoseconds since the Epoch.
+ * The seg_* columns cache the geodesic from point i to point i + 1
+ * (the last slot is unused).
+ *
+ * A compact store keeps the attributes in the fixed-point *_e* columns
+ * instead (about 25 bytes a point), has no segment cache and leaves the
+ * double columns NULL; read points with the trk_point_* accessors.
+ *
+ * Columns of an attached store live in a private file mapping; they are
+ * copied to the heap before the store grows.
+ */
+struct points_o {
+    int64_t * time;
+    double  * latitude;
+    double  * longitude;
+    double  * altitude;
+    double  * azimuth;
+    double  * speed;
+    int     * nsat;
+    int     * fix_type;
+    double  * hdop;
+    double  * vdop;
+    double  * pdop;
+
+    double  * seg_length;
+    double  * seg_azimuth;
+    double  * seg_speed;
+
+    /* compact store: milliseconds from origin, degrees * 1e7, cm, 0.01 deg,
+     * cm/s, DOP * 10; the largest (or most negative) value means unset */
+    int       compact;
+    int64_t   origin;
+    int32_t  * time_ms;
+    int32_t  * latitude_e7;
+    int32_t  * longitude_e7;
+    int32_t  * altitude_cm;
+    uint16_t * azimuth_e2;
+    uint16_t * speed_cm;
+    uint8_t  * nsat_e0;
+    int8_t   * fix_type_e0;
+    uint8_t  * hdop_e1;
+    uint8_t  * vdop_e1;
+    uint8_t  * pdop_e1;
+
+    void    * map;
+    size_t    map_size;
+
+    size_t    count;
+    size_t    capacity;
 };
 
 
-point_t trk_point_make( time_t  time,
-			double  latitude,
-			double  longitude,
-			double  altitude,
-			double  azimuth,
-			double  speed,
-			int     nsat,
-			int     fix_type,
-			double  hdop,
-			double  vdop,
-			double  pdop );
+#define POINTS_UNSET_I32 INT32_MIN
+#define POINTS_UNSET_U16 UINT16_MAX
+#define POINTS_UNSET_U8  UINT8_MAX
 
-void trk_point_free( point_t point );
 
+void trk_points_init( points_t points );
 
-#endif
+void trk_points_free( points_t points );
+
+int trk_points_set_compact( points_t points, int compact );
+
+size_t trk_points_ncolumns( const struct points_o * points );
+
+const void * trk_points_column_data( const struct points_o * points,
+				     size_t                  k,
+				     size_t                * size );
+
+void trk_points_column_last( const struct points_o * points,
+			     size_t                  k,
+			     void                  * last );
+
+size_t trk_points_column_size( int compact, size_t k );
+
+void trk_points_attach( points_t       points,
+			void         * map,
+			size_t         map_size,
+			int            compact,
+			int64_t        origin,
+			size_t         count,
+			void * const * columns );
+
+int trk_points_reserve( points_t points, size_t capacity );
+
+int trk_points_relocate( points_t points, size_t capacity, points_t old );
+
+size_t trk_points_memory( const struct points_o * points );
+
+void trk_points_shrink( points_t points );
+
+int trk_points_append( points_t points,
+		       int64_t  time,
+		       double   latitude,
+		       double   longitude,
+		       double   altitude,
+		       double   azimuth,
+		       double   speed,
+		       int      nsat,
+		       int      fix_type,
+		       double   hdop,
+		       double   vdop,
+		       double   pdop );
+
+int trk_points_append_points( points_t                points,
+			      const struct points_o * src,
+			      size_t                  from );
+
+int trk_points_sort( points_t points );
+
+size_t trk_points_compact( points_t points );
 
+void trk_points_update_segments( points_t                     points,
+				 const struct geod_geodesic * g,
+				 size_t                       from );
+
+void trk_points_segment( const struct points_o      * points,
+			 const struct geod_geodesic * g,
+			 size_t                       i,
+			 double                     * length,
+			 double                     * azimuth,
+			 double                     * speed );
+
+size_t trk_points_lower_bound( const struct points_o * points, int64_t time );
+
+
+static inline int64_t trk_point_time( const struct points_o * p, size_t i )
+{
+    return p->compact ? p->origin + ( int64_t )p->time_ms[i] * 1000000 : p->time[i];
+}
+
+static inline double trk_point_e7( int32_t v )
+{
+    return v == POINTS_UNSET_I32 ? NAN : v * 1e-7;
+}
+
+static inline double trk_point_latitude( const struct points_o * p, size_t i )
+{
+    return p->compact ? trk_point_e7( p->latitude_e7[i] ) : p->latitude[i];
+}
+
+static inline double trk_point_longitude( const struct points_o * p, size_t i )
+{
+    return p->compact ? trk_point_e7( p->longitude_e7[i] ) : p->longitude[i];
+}
+
+static inline double trk_point_altitude( const struct points_o * p, size_t i )
+{
+    if( !p->compact )
+	return p->altitude[i];
+
+    return p->altitude_cm[i] == POINTS_UNSET_I32 ? NAN : p->altitude_cm[i] * 1e-2;
+}
+
+static inline double trk_point_azimuth( const struct points_o * p, size_t i )
+{
+    if( !p->compact )
+	return p->azimuth[i];
+
+    return p->azimuth_e2[i] == POINTS_UNSET_U16 ? NAN : p->azimuth_e2[i] * 1e-2;
+}
+
+static inline double trk_point_speed( const struct points_o * p, size_t i )
+{
+    if( !p->compact )
+	return p->speed[i];
+
+    return p->speed_cm[i] == POINTS_UNSET_U16 ? NAN : p->speed_cm[i] * 1e-2;
+}
+
+static inline int trk_point_nsat( const struct points_o * p, size_t i )
+{
+    if( !p->compact )
+	return p->nsat[i];
+
+    return p->nsat_e0[i] == POINTS_UNSET_U8 ? -1 : p->nsat_e0[i];
+}
+
+static inline int trk_point_fix_type( const struct points_o * p, size_t i )
+{
+    return p->compact ? p->fix_type_e0[i] : p->fix_type[i];
+}
+
+static inline double trk_point_e1( uint8_t v )
+{
+    return v == POINTS_UNSET_U8 ? NAN : v * 1e-1;
+}
+
+static inline double trk_point_hdop( const struct points_o * p, size_t i )
+{
+    return p->compact ? trk_point_e1( p->hdop_e1[i] ) : p->hdop[i];
+}
+
+static inline double trk_point_vdop( const struct points_o * p, size_t i )
+{
+    return p->compact ? trk_point_e1( p->vdop_e1[i] ) : p->vdop[i];
+}
+
+static inline double trk_point_pdop( const struct points_o * p, size_t i )
+{
+    return p->compact ? trk_point_e1( p->pdop_e1[i] ) : p->pdop[i];
+}
+
+
+#endif
@@ -0,0 +1,526 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, binary track snapshots.
+ *
+ */
+
+/**
+ * @file snapshot.c Binary track snapshot implementation.
+ *
+ * A snapshot is the finalized point store written column by column in
+ * native byte order: a header, a column table and the columns, each
+ * aligned to SNAPSHOT_ALIGN bytes. Loading maps the file privately and
+ * the store uses the columns in place.
+ *
+ * Sidecar snapshots cache parsed track files; their header carries the
+ * identity of the source file, and they are only used while it matches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "track_priv.h"
+
+
+#define SNAPSHOT_MAGIC       "TRKSNAP"
+#define SNAPSHOT_VERSION     2
+#define SNAPSHOT_BYTE_ORDER  0x01020304
+#define SNAPSHOT_ALIGN       64
+#define SNAPSHOT_MAX_COLUMNS 32
+
+#define SIDECAR_SUFFIX       ".trks"
+
+/* header flags */
+#define SNAPSHOT_COMPACT     0x01
+
+#define CHECKSUM_PRIME1      0x9e3779b185ebca87ULL
+#define CHECKSUM_PRIME2      0xc2b2ae3d27d4eb4fULL
+#define CHECKSUM_PRIME3      0x165667b19e3779f9ULL
+
+
+/*
+ * The header checksum covers the header, with the checksum itself set
+ * to 0, and the column table; the data checksum covers the point data
+ * of every column in table order.
+ */
+struct snapshot_header {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  byte_order;
+    uint32_t  flags;
+    uint32_t  ncolumns;
+    uint64_t  count;
+    int64_t   origin;
+    uint64_t  size;
+    struct snapshot_key key;
+    uint64_t  data_checksum;
+    uint64_t  header_checksum;
+};
+
+struct snapshot_column {
+    uint64_t  offset;
+    uint32_t  size;
+    uint32_t  reserved;
+};
+
+
+static int trk_check_snapshot( track_t                     track,
+			       const char                * path,
+			       const char                * map,
+			       size_t                      size,
+			       unsigned                    flags,
+			       const struct snapshot_key * key );
+static void trk_snapshot_error( track_t      track,
+				unsigned     flags,
+				const char * fmt, ... )
+    __attribute__ ((format(printf, 3, 4)));
+static uint64_t trk_snapshot_header_checksum( const struct snapshot_header * header,
+					      const struct snapshot_column * columns );
+static int trk_write_padding( FILE * f, size_t n );
+static uint64_t trk_checksum_column( const void * data,
+				     size_t       size,
+				     size_t       count,
+				     const void * last,
+				     uint64_t     seed );
+static uint64_t trk_checksum_words( uint64_t h, const void * data, size_t size );
+static uint64_t trk_checksum_final( uint64_t h );
+
+
+
+/*
+ * Save points of the track; on a live track they must be a read view.
+ * Its count is read once, and the last point of each column is copied
+ * once, as the writer still fills its segment cache slot.
+ */
+int trk_write_snapshot( track_t                     track,
+			const struct points_o     * points,
+			const char                * path,
+			unsigned                    flags,
+			const struct snapshot_key * key )
+{
+    struct snapshot_header header;
+    struct snapshot_column columns[SNAPSHOT_MAX_COLUMNS];
+    const void *data[SNAPSHOT_MAX_COLUMNS];
+    unsigned char last[SNAPSHOT_MAX_COLUMNS][sizeof( uint64_t )];
+    size_t i, n, size, offset, count = points->count;
+    char *tmp;
+    FILE *f;
+    int fd;
+
+    if( count == 0 ) {
+	trk_snapshot_error( track, flags, "can not save '%s': track is empty", path );
+	return 0;
+    }
+
+    n = trk_points_ncolumns( points );
+
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, SNAPSHOT_MAGIC, sizeof( SNAPSHOT_MAGIC ) );
+    header.version    = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.flags      = points->compact ? SNAPSHOT_COMPACT : 0;
+    header.ncolumns   = n;
+    header.count      = count;
+    header.origin     = points->origin;
+    if( key )
+	header.key    = *key;
+
+    offset = sizeof( header ) + n * sizeof( *columns );
+    for( i = 0; i < n; i++ ) {
+	data[i] = trk_points_column_data( points, i, &size );
+	assert( size <= sizeof( last[i] ) );
+	trk_points_column_last( points, i, last[i] );
+
+	offset = ( offset + SNAPSHOT_ALIGN - 1 ) & ~( size_t )( SNAPSHOT_ALIGN - 1 );
+	columns[i].offset   = offset;
+	columns[i].size     = size;
+	columns[i].reserved = 0;
+
+	header.data_checksum = trk_checksum_column( data[i], size, count, last[i],
+						    header.data_checksum );
+	offset += count * size;
+    }
+    header.size = offset;
+    header.header_checksum = trk_snapshot_header_checksum( &header, columns );
+
+    /* written aside and renamed, so readers never see a partial file */
+    tmp = malloc( strlen( path ) + sizeof( ".XXXXXX" ) );
+    if( !tmp ) {
+	trk_snapshot_error( track, flags, "can not save '%s': %s", path, strerror( errno ) );
+	return 0;
+    }
+    sprintf( tmp, "%s.XXXXXX", path );
+
+    fd = mkstemp( tmp );
+    if( fd != -1 )
+	fchmod( fd, 0644 );
+    if( fd == -1 || !( f = fdopen( fd, "wb" ) ) ) {
+	trk_snapshot_error( track, flags, "can not create '%s': %s", tmp, strerror( errno ) );
+	if( fd != -1 ) {
+	    close( fd );
+	    unlink( tmp );
+	}
+	free( tmp );
+	return 0;
+    }
+
+    offset = sizeof( header ) + n * sizeof( *columns );
+    if( fwrite( &header, sizeof( header ), 1, f ) != 1 ||
+	fwrite( columns, sizeof( *columns ), n, f ) != n )
+	goto fail;
+
+    for( i = 0; i < n; i++ ) {
+	if( !trk_write_padding( f, columns[i].offset - offset ) ||
+	    fwrite( data[i], columns[i].size, count - 1, f ) != count - 1 ||
+	    fwrite( last[i], columns[i].size, 1, f ) != 1 )
+	    goto fail;
+	offset = columns[i].offset + count * columns[i].size;
+    }
+
+    if( fclose( f ) ) {
+	f = NULL;
+	goto fail;
+    }
+
+    if( rename( tmp, path ) ) {
+	f = NULL;
+	goto fail;
+    }
+
+    free( tmp );
+
+    return 1;
+
+fail:
+    trk_snapshot_error( track, flags, "can not write '%s': %s", path, strerror( errno ) );
+    if( f )
+	fclose( f );
+    unlink( tmp );
+    free( tmp );
+
+    return 0;
+}
+
+/*
+ * Load a snapshot. Into an empty track of the same encoding the columns
+ * are mapped in place; otherwise the points are added as by any other
+ * load. The header and column table are always checked, the point data
+ * only with SNAPSHOT_VERIFY. With a key, the snapshot must have been
+ * made from that source. With SNAPSHOT_CHECK nothing is loaded.
+ */
+int trk_read_snapshot( track_t                     track,
+		       const char                * path,
+		       unsigned                    flags,
+		       const struct snapshot_key * key )
+{
+    struct points_o *points = trk_get_points( track ), snap;
+    const struct snapshot_header *header;
+    const struct snapshot_column *columns;
+    void *cols[SNAPSHOT_MAX_COLUMNS];
+    struct stat st;
+    char *map;
+    size_t i, npoints;
+    int fd, ret;
+
+    fd = open( path, O_RDONLY, 0 );
+    if( fd == -1 ) {
+	trk_snapshot_error( track, flags, "can not open '%s': %s", path, strerror( errno ) );
+	return 0;
+    }
+
+    if( fstat( fd, &st ) ) {
+	trk_snapshot_error( track, flags, "can not stat '%s': %s", path, strerror( errno ) );
+	close( fd );
+	return 0;
+    }
+
+    if( ( size_t )st.st_size < sizeof( *header ) ) {
+	trk_snapshot_error( track, flags, "'%s' is not a track snapshot", path );
+	close( fd );
+	return 0;
+    }
+
+    /* private and writable: the store may change in place, the file never */
+    map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if( map == MAP_FAILED ) {
+	trk_snapshot_error( track, flags, "can not map '%s': %s", path, strerror( errno ) );
+	close( fd );
+	return 0;
+    }
+
+    close( fd );
+
+    if( !trk_check_snapshot( track, path, map, st.st_size, flags, key ) ) {
+	munmap( map, st.st_size );
+	return 0;
+    }
+
+    if( flags & SNAPSHOT_CHECK ) {
+	munmap( map, st.st_size );
+	return 1;
+    }
+
+    header = ( const struct snapshot_header * )map;
+    columns = ( const struct snapshot_column * )( header + 1 );
+
+    for( i = 0; i < header->ncolumns; i++ )
+	cols[i] = map + columns[i].offset;
+
+    trk_points_init( &snap );
+    trk_points_attach( &snap, map, st.st_size, header->flags & SNAPSHOT_COMPACT,
+		       header->origin, header->count, cols );
+
+    if( points->count == 0 && points->compact == snap.compact ) {
+	trk_points_free( points );
+	*points = snap;
+	return 1;
+    }
+
+    npoints = points->count;
+
+    ret = trk_points_append_points( points, &snap, 0 );
+    trk_points_free( &snap );
+
+    if( !ret ) {
+	trk_error( track, "can not add points: %s", strerror( errno ) );
+	trk_truncate( track, npoints );
+	return 0;
+    }
+
+    return trk_finalize( track );
+}
+
+/*
+ * Cache file of a track file: next to it for an empty dir, otherwise
+ * in dir and named after the checksum of its absolute path. The seed
+ * goes into the checksum, so that loads with different options get
+ * their own entries in dir.
+ */
+char * trk_sidecar_path( const char * dir,
+			 const char * file,
+			 uint64_t     seed,
+			 uint64_t   * path_hash )
+{
+    char abspath[PATH_MAX], *path;
+    const char *name;
+    size_t len;
+
+    name = realpath( file, abspath ) ? abspath : file;
+    *path_hash = trk_checksum( name, strlen( name ), seed );
+
+    if( !*dir ) {
+	len = strlen( file ) + sizeof( SIDECAR_SUFFIX );
+	path = malloc( len );
+	if( path )
+	    snprintf( path, len, "%s" SIDECAR_SUFFIX, file );
+    } else {
+	len = strlen( dir ) + 1 + 16 + sizeof( SIDECAR_SUFFIX );
+	path = malloc( len );
+	if( path )
+	    snprintf( path, len, "%s/%016llx" SIDECAR_SUFFIX,
+		      dir, ( unsigned long long )*path_hash );
+    }
+
+    return path;
+}
+
+/*
+ * Checksum with 64-bit multiply-rotate rounds; fast enough to run over
+ * large snapshots, not meant to resist deliberate collisions.
+ */
+uint64_t trk_checksum( const void * data, size_t size, uint64_t seed )
+{
+    return trk_checksum_final( trk_checksum_words( seed ^ ( size * CHECKSUM_PRIME1 ),
+						   data, size ) );
+}
+
+
+static uint64_t trk_checksum_words( uint64_t h, const void * data, size_t size )
+{
+    const unsigned char *p = data;
+    uint64_t w;
+
+    for( ; size >= 8; p += 8, size -= 8 ) {
+	memcpy( &w, p, 8 );
+	h ^= w * CHECKSUM_PRIME2;
+	h = ( ( h << 31 ) | ( h >> 33 ) ) * CHECKSUM_PRIME1;
+    }
+
+    if( size ) {
+	w = 0;
+	memcpy( &w, p, size );
+	h ^= w * CHECKSUM_PRIME2;
+	h = ( ( h << 31 ) | ( h >> 33 ) ) * CHECKSUM_PRIME1;
+    }
+
+    return h;
+}
+
+static uint64_t trk_checksum_final( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= CHECKSUM_PRIME3;
+    h ^= h >> 29;
+
+    return h;
+}
+
+
+static int trk_check_snapshot( track_t                     track,
+			       const char                * path,
+			       const char                * map,
+			       size_t                      size,
+			       unsigned                    flags,
+			       const struct snapshot_key * key )
+{
+    const struct snapshot_header *header = ( const struct snapshot_header * )map;
+    const struct snapshot_column *columns;
+    uint64_t checksum = 0;
+    size_t i, n, elsize;
+    int compact;
+
+    if( memcmp( header->magic, SNAPSHOT_MAGIC, sizeof( SNAPSHOT_MAGIC ) ) ) {
+	trk_snapshot_error( track, flags, "'%s' is not a track snapshot", path );
+	return 0;
+    }
+
+    if( header->byte_order != SNAPSHOT_BYTE_ORDER ) {
+	trk_snapshot_error( track, flags, "'%s': snapshot byte order does not match", path );
+	return 0;
+    }
+
+    if( header->version != SNAPSHOT_VERSION ) {
+	trk_snapshot_error( track, flags, "'%s': unsupported snapshot version %u",
+			    path, ( unsigned )header->version );
+	return 0;
+    }
+
+    n = header->ncolumns;
+    if( header->size != size || n > SNAPSHOT_MAX_COLUMNS ||
+	size < sizeof( *header ) + n * sizeof( *columns ) ) {
+	trk_snapshot_error( track, flags, "'%s': snapshot is truncated or corrupt", path );
+	return 0;
+    }
+
+    columns = ( const struct snapshot_column * )( header + 1 );
+
+    if( trk_snapshot_header_checksum( header, columns ) != header->header_checksum ) {
+	trk_snapshot_error( track, flags, "'%s': snapshot header checksum mismatch", path );
+	return 0;
+    }
+
+    if( key && memcmp( &header->key, key, sizeof( *key ) ) ) {
+	trk_snapshot_error( track, flags, "'%s': snapshot is out of date", path );
+	return 0;
+    }
+
+    compact = ( header->flags & SNAPSHOT_COMPACT ) != 0;
+
+    if( trk_points_column_size( compact, n ) != 0 ||
+	( n > 0 && trk_points_column_size( compact, n - 1 ) == 0 ) ) {
+	trk_snapshot_error( track, flags, "'%s': snapshot columns do not match", path );
+	return 0;
+    }
+
+    for( i = 0; i < n; i++ ) {
+	elsize = trk_points_column_size( compact, i );
+
+	if( columns[i].size != elsize || columns[i].offset % SNAPSHOT_ALIGN ||
+	    columns[i].offset > size ||
+	    header->count > ( size - columns[i].offset ) / elsize ) {
+	    trk_snapshot_error( track, flags, "'%s': snapshot columns do not match", path );
+	    return 0;
+	}
+    }
+
+    if( header->count == 0 ) {
+	trk_snapshot_error( track, flags, "No valid points found" );
+	return 0;
+    }
+
+    if( flags & SNAPSHOT_VERIFY ) {
+	for( i = 0; i < n; i++ )
+	    checksum = trk_checksum( map + columns[i].offset,
+				     header->count * columns[i].size, checksum );
+
+	if( checksum != header->data_checksum ) {
+	    trk_snapshot_error( track, flags, "'%s': snapshot data checksum mismatch", path );
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+static uint64_t trk_snapshot_header_checksum( const struct snapshot_header * header,
+					      const struct snapshot_column * columns )
+{
+    struct snapshot_header h = *header;
+
+    h.header_checksum = 0;
+
+    return trk_checksum( columns, h.ncolumns * sizeof( *columns ),
+			 trk_checksum( &h, sizeof( h ), 0 ) );
+}
+
+static void trk_snapshot_error( track_t      track,
+				unsigned     flags,
+				const char * fmt, ... )
+{
+    char msg[4096];
+    va_list ap;
+
+    if( flags & SNAPSHOT_QUIET )
+	return;
+
+    va_start( ap, fmt );
+    vsnprintf( msg, sizeof( msg ), fmt, ap );
+    va_end( ap );
+
+    trk_error( track, "%s", msg );
+}
+
+static int trk_write_padding( FILE * f, size_t n )
+{
+    static const char zeros[SNAPSHOT_ALIGN];
+
+    return n == 0 || fwrite( zeros, 1, n, f ) == n;
+}
+
+/*
+ * trk_checksum() of count elements of the given size, the last one taken
+ * from last instead of the column.
+ */
+static uint64_t trk_checksum_column( const void * data,
+				     size_t       size,
+				     size_t       count,
+				     const void * last,
+				     uint64_t     seed )
+{
+    unsigned char tail[2 * sizeof( uint64_t )];
+    size_t total = count * size, head, rest;
+    uint64_t h;
+
+    /* whole words before the last element, then the rest through a copy */
+    head = ( ( count - 1 ) * size ) & ~( size_t )7;
+    rest = ( count - 1 ) * size - head;
+
+    assert( rest + size <= sizeof( tail ) );
+    memcpy( tail, ( const char * )data + head, rest );
+    memcpy( tail + rest, last, size );
+
+    h = trk_checksum_words( seed ^ ( total * CHECKSUM_PRIME1 ), data, head );
+    h = trk_checksum_words( h, tail, rest + size );
+
+    return trk_checksum_final( h );
+}
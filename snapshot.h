@@ -0,0 +1,60 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, binary track snapshots.
+ *
+ */
+
+/**
+ * @file snapshot.h Binary track snapshot header.
+ */
+
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "track.h"
+#include "point.h"
+
+
+/* trk_read_snapshot() and trk_write_snapshot() flags */
+#define SNAPSHOT_VERIFY 0x01	/* check the point data checksum */
+#define SNAPSHOT_QUIET  0x02	/* do not report errors */
+#define SNAPSHOT_CHECK  0x04	/* only check the snapshot, do not load it */
+
+/*
+ * Identity of the file a snapshot was made from and of the options it
+ * was loaded with, all 0 if none.
+ */
+struct snapshot_key {
+    uint64_t  size;
+    int64_t   mtime;		/* nanoseconds */
+    uint64_t  path_hash;
+    uint64_t  hash;		/* content checksum */
+    uint32_t  nmea_sentences;	/* TRK_NMEA_* */
+    uint32_t  compact;
+};
+
+
+int trk_write_snapshot( track_t                     track,
+			const struct points_o     * points,
+			const char                * path,
+			unsigned                    flags,
+			const struct snapshot_key * key );
+
+int trk_read_snapshot( track_t                     track,
+		       const char                * path,
+		       unsigned                    flags,
+		       const struct snapshot_key * key );
+
+char * trk_sidecar_path( const char * dir,
+			 const char * file,
+			 uint64_t     seed,
+			 uint64_t   * path_hash );
+
+uint64_t trk_checksum( const void * data, size_t size, uint64_t seed );
+
+
+#endif
@@ -0,0 +1,165 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, data format sniffer.
+ *
+ */
+
+/**
+ * @file sniff.c Data format sniffer implementation.
+ *
+ * Looks at the first bytes of the data only, so detection cost does not
+ * depend on the data size.
+ */
+
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "sniff.h"
+
+
+/* how far to look for the XML root element */
+#define SNIFF_XML_WINDOW  4096
+
+/* how far to look for the first complete NMEA sentence */
+#define SNIFF_NMEA_WINDOW 256
+
+
+struct sniff_magic {
+    size_t       offset;
+    const char * magic;
+    size_t       len;
+    const char * name;
+};
+
+static const struct sniff_magic binary_magics[] = {
+    { 0, "\x1f\x8b",          2, "gzip" },
+    { 0, "BZh",               3, "bzip2" },
+    { 0, "\xfd" "7zXZ\0",     6, "xz" },
+    { 0, "PK\x03\x04",        4, "zip" },
+    { 8, ".FIT",              4, "FIT" },
+    { 0, "\xb5\x62",          2, "UBX" },
+    { 0, "\xa0\xa2",          2, "SiRF" },
+};
+
+
+static enum trk_format trk_sniff_xml( const char * p, const char * end );
+static int trk_sniff_nmea( const char * p, const char * end );
+
+
+
+enum trk_format trk_sniff_format( const void  * data,
+				  size_t        size,
+				  const char ** name )
+{
+    const char *p = data, *end = p + size;
+    enum trk_format format;
+    size_t i;
+
+    for( i = 0; i < sizeof( binary_magics ) / sizeof( binary_magics[0] ); i++ ) {
+	const struct sniff_magic *m = &binary_magics[i];
+
+	if( size >= m->offset + m->len &&
+	    !memcmp( p + m->offset, m->magic, m->len ) ) {
+	    if( name )
+		*name = m->name;
+	    return TRK_FORMAT_BINARY;
+	}
+    }
+
+    /* UTF-8 BOM */
+    if( size >= 3 && !memcmp( p, "\xef\xbb\xbf", 3 ) )
+	p += 3;
+
+    while( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ) )
+	p++;
+
+    if( p < end && *p == '<' ) {
+	format = trk_sniff_xml( p, end - p > SNIFF_XML_WINDOW ? p + SNIFF_XML_WINDOW : end );
+	if( name )
+	    *name = format == TRK_FORMAT_GPX ? "GPX" :
+		format == TRK_FORMAT_TCX ? "TCX" : "XML";
+	return format;
+    }
+
+    /* a log may start in the middle of a sentence */
+    if( trk_sniff_nmea( p, end ) ||
+	( ( p = memchr( p, '\n', end - p > SNIFF_NMEA_WINDOW ? SNIFF_NMEA_WINDOW : end - p ) ) &&
+	  trk_sniff_nmea( p + 1, end ) ) ) {
+	if( name )
+	    *name = "NMEA";
+	return TRK_FORMAT_NMEA;
+    }
+
+    if( name )
+	*name = NULL;
+
+    return TRK_FORMAT_UNKNOWN;
+}
+
+
+/*
+ * Find the root element, skipping the XML declaration, processing
+ * instructions, comments and the document type declaration.
+ */
+static enum trk_format trk_sniff_xml( const char * p, const char * end )
+{
+    const char *name, *colon;
+    size_t len;
+
+    while( p < end ) {
+	p = memchr( p, '<', end - p );
+	if( !p || end - p < 2 )
+	    break;
+
+	if( p[1] == '?' || p[1] == '!' ) {
+	    if( end - p >= 4 && !memcmp( p, "<!--", 4 ) ) {
+		p = memmem( p + 4, end - p - 4, "-->", 3 );
+		if( !p )
+		    break;
+	    }
+	    p++;
+	    continue;
+	}
+
+	name = p + 1;
+	for( p = name; p < end && *p != '>' && *p != '/' &&
+		 *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'; p++ )
+	    ;
+
+	/* namespace prefix */
+	colon = memchr( name, ':', p - name );
+	if( colon )
+	    name = colon + 1;
+
+	len = p - name;
+
+	if( len == 3 && !memcmp( name, "gpx", 3 ) )
+	    return TRK_FORMAT_GPX;
+	if( len == 22 && !memcmp( name, "TrainingCenterDatabase", 22 ) )
+	    return TRK_FORMAT_TCX;
+
+	break;
+    }
+
+    return TRK_FORMAT_XML;
+}
+
+/*
+ * NMEA 0183 sentence: '$', two character talker, three character
+ * sentence type, ',' ("$GPRMC,", "$GNGGA,", "$PGRME," ...).
+ */
+static int trk_sniff_nmea( const char * p, const char * end )
+{
+    int i;
+
+    if( end - p < 7 || p[0] != '$' || p[6] != ',' )
+	return 0;
+
+    for( i = 1; i < 6; i++ ) {
+	if( !( ( p[i] >= 'A' && p[i] <= 'Z' ) || ( p[i] >= '0' && p[i] <= '9' ) ) )
+	    return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,33 @@
+/* -*- Mode: C; c-basic-offset: 4; -*-
+ *
+ * Track utils library, data format sniffer.
+ *
+ */
+
+/**
+ * @file sniff.h Data format sniffer header.
+ */
+
+#ifndef SNIFF_H_INCLUDED
+#define SNIFF_H_INCLUDED
+
+
+#include <stddef.h>
+
+
+enum trk_format {
+    TRK_FORMAT_UNKNOWN = 0,
+    TRK_FORMAT_GPX,
+    TRK_FORMAT_TCX,
+    TRK_FORMAT_XML,		/* XML with other root element */
+    TRK_FORMAT_NMEA,
+    TRK_FORMAT_BINARY,		/* recognized, but unsupported binary format */
+};
+
+
+enum trk_format trk_sniff_format( const void  * data,
+				  size_t        size,
+				  const char ** name );
+
+
+#endif
@@ -6,224 +6,229 @@
 
 /**
  * @file tcx.c TCX parser implementation.
+ *
+ * Like the GPX parser, the document is streamed through xmlTextReader
+ * and every Trackpoint is converted as soon as its end tag is read.
  */
 
 
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <math.h>
 
+#include <libxml/xmlreader.h>
+
 #include "tcx.h"
 #include "track_priv.h"
+#include "number.h"
 
 
-static int trk_parse_tcx_activities( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_tcx_activity( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_tcx_activity_lap( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_tcx_track( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_tcx_trackpoint( track_t track, xmlDocPtr doc, xmlNodePtr node );
-static int trk_parse_tcx_trackpoint_position( track_t      track,
-					      xmlDocPtr    doc,
-					      xmlNodePtr   node,
-					      double     * latitude,
-					      double     * longitude );
-static int trk_parse_tcx_trackpoint_extensions( track_t      track,
-						xmlDocPtr    doc,
-						xmlNodePtr   node,
-						double     * speed );
+#define TCX_PARSE_OPTIONS ( XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_COMPACT )
 
 
-int trk_parse_tcx( track_t track, xmlDocPtr doc, xmlNodePtr node )
-{
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Author" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Folders" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Activities" ) ) {
-	    if( !trk_parse_tcx_activities( track, doc, node ) ) {
-		return 0;
-	    }
-	}
-    }
+enum tcx_field {
+    TCX_FIELD_NONE = 0,
+    TCX_FIELD_TIME,
+    TCX_FIELD_LATITUDE,
+    TCX_FIELD_LONGITUDE,
+    TCX_FIELD_ALTITUDE,
+    TCX_FIELD_SPEED,
+};
 
-    return 1;
-}
+struct tcx_point {
+    int64_t  time;
+    int      valid;
+    double   latitude;
+    double   longitude;
+    double   altitude;
+    double   speed;
+};
 
-static int trk_parse_tcx_activities( track_t track, xmlDocPtr doc, xmlNodePtr node )
-{
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Activity" ) ) {
-	    if( !trk_parse_tcx_activity( track, doc, node ) ) {
-		return 0;
-	    }
-	}
-    }
 
-    return 1;
-}
+static size_t trk_count_tcx_points( const void * data, size_t size );
+static int trk_parse_tcx_trackpoint( track_t track, xmlTextReaderPtr reader );
+static enum tcx_field trk_tcx_field( const xmlChar * name );
+static void trk_parse_tcx_value( struct tcx_point * point,
+				 enum tcx_field     field,
+				 const xmlChar    * value );
 
-static int trk_parse_tcx_activity( track_t track, xmlDocPtr doc, xmlNodePtr node )
-{
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Id" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Creator" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Lap" ) ) {
-	    if( !trk_parse_tcx_activity_lap( track, doc, node ) ) {
-		return 0;
-	    }
-	}
-    }
 
-    return 1;
-}
 
-static int trk_parse_tcx_activity_lap( track_t track, xmlDocPtr doc, xmlNodePtr node )
+int trk_parse_tcx( track_t track, const void * data, size_t size )
 {
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"TotalTimeSeconds" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"DistanceMeters" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"MaximumSpeed" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Calories" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"AverageHeartRateBpm" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"MaximumHeartRateBpm" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Intensity" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"TriggerMethod" ) ) {
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Track" ) ) {
-	    if( !trk_parse_tcx_track( track, doc, node ) ) {
-		return 0;
-	    }
-	}
-    }
+    xmlTextReaderPtr reader;
+    const xmlChar *name;
+    size_t npoints;
+    int ret, ok = 1;
 
-    return 1;
-}
+    npoints = trk_get_npoints( track );
 
-static int trk_parse_tcx_track( track_t track, xmlDocPtr doc, xmlNodePtr node )
-{
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Trackpoint" ) ) {
-	    if( !trk_parse_tcx_trackpoint( track, doc, node ) ) {
-		return 0;
-	    }
-	}
-    }
+    if( !trk_reserve( track, npoints + trk_count_tcx_points( data, size ) ) )
+	return 0;
 
-    return 1;
-}
+    reader = xmlReaderForMemory( ( const char * )data, size,
+				 NULL, NULL, TCX_PARSE_OPTIONS );
+    if( !reader ) {
+	trk_error( track, "can not parse XML" );
+	return 0;
+    }
 
-static int trk_parse_tcx_trackpoint( track_t track, xmlDocPtr doc, xmlNodePtr node )
-{
-    double latitude = NAN, longitude = NAN, altitude = NAN, azimuth = NAN, speed = NAN;
-    time_t time = 0;
-    int nsat = -1, fix_type = -1;
-    double hdop = NAN, vdop = NAN, pdop = NAN;
-
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Time" ) ) {
-	    xmlChar *val;
-	    struct tm tm;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-
-	    strptime( ( const char * )val, "%FT%TZ", &tm );
-	    tm.tm_isdst = -1;
-	    time = mktime( &tm );
-
-	    xmlFree( val );
-
-	    if( time == -1 )
-		return 1;
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Position" ) ) {
-	    if( !trk_parse_tcx_trackpoint_position( track, doc, node,
-						    &latitude, &longitude ) ) {
-		return 1;
-	    }
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"AltitudeMeters" ) ) {
-	    xmlChar *val;
+    while( ok && ( ret = xmlTextReaderRead( reader ) ) == 1 ) {
+	if( xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT )
+	    continue;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    altitude = atof( ( const char * )val );
+	name = xmlTextReaderConstLocalName( reader );
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"Extensions" ) ) {
-	    if( !trk_parse_tcx_trackpoint_extensions( track, doc, node, &speed ) ) {
-		return 1;
+	if( xmlTextReaderDepth( reader ) == 0 ) {
+	    if( xmlStrcmp( name, ( const xmlChar * )"TrainingCenterDatabase" ) ) {
+		trk_error( track, "XML type is not supported: '%s'", name );
+		ok = 0;
 	    }
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"DistanceMeters" ) ) {
+	} else if( !xmlStrcmp( name, ( const xmlChar * )"Trackpoint" ) ) {
+	    ok = trk_parse_tcx_trackpoint( track, reader );
 	}
     }
 
-    return trk_add_point( track,
-			  time,
-			  latitude,
-			  longitude,
-			  altitude,
-			  azimuth,
-			  speed,
-			  nsat,
-			  fix_type,
-			  hdop,
-			  vdop,
-			  pdop );
-}
-
-static int trk_parse_tcx_trackpoint_position( track_t      track,
-					      xmlDocPtr    doc,
-					      xmlNodePtr   node,
-					      double     * latitude,
-					      double     * longitude )
-{
-    double lat = NAN, lng = NAN;
+    xmlFreeTextReader( reader );
 
-    ( void )track;
+    if( ok && ret != 0 ) {
+	trk_error( track, "can not parse XML" );
+	ok = 0;
+    }
 
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"LatitudeDegrees" ) ) {
-	    xmlChar *val;
+    if( !ok )
+	trk_truncate( track, npoints );
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    lat = atof( ( const char * )val );
+    return ok;
+}
 
-	    xmlFree( val );
-	} else if( !xmlStrcmp( node->name, ( const xmlChar * )"LongitudeDegrees" ) ) {
-	    xmlChar *val;
 
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    lng = atof( ( const char * )val );
+/*
+ * Upper estimate of the number of points, to presize the track.
+ */
+static size_t trk_count_tcx_points( const void * data, size_t size )
+{
+    const char *p = data, *end = p + size;
+    size_t n = 0;
 
-	    xmlFree( val );
-	}
+    while( ( p = memchr( p, '<', end - p ) ) ) {
+	p++;
+	if( end - p >= 10 && !memcmp( p, "Trackpoint", 10 ) )
+	    n++;
     }
 
-    if( latitude )
-	*latitude = lat;
-    if( longitude )
-	*longitude = lng;
-
-    return 1;
+    return n;
 }
 
-static int trk_parse_tcx_trackpoint_extensions( track_t      track,
-						xmlDocPtr    doc,
-						xmlNodePtr   node,
-						double     * speed )
+/*
+ * Convert the Trackpoint element the reader is positioned on, consuming
+ * it up to its end tag. Speed is looked up in the trackpoint extensions
+ * (TPX) by local name.
+ */
+static int trk_parse_tcx_trackpoint( track_t track, xmlTextReaderPtr reader )
 {
-    double spd = NAN;
-
-    ( void )track;
-
-    for( node = node->xmlChildrenNode; node; node = node->next ) {
-	if( !xmlStrcmp( node->name, ( const xmlChar * )"Speed" ) ) {
-	    xmlChar *val;
-
-	    val = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-	    spd = atof( ( const char * )val );
-
-	    xmlFree( val );
+    struct tcx_point point = {
+	.time      = 0,
+	.valid     = 1,
+	.latitude  = NAN,
+	.longitude = NAN,
+	.altitude  = NAN,
+	.speed     = NAN,
+    };
+    enum tcx_field field = TCX_FIELD_NONE;
+    int depth, type, ret;
+
+    if( xmlTextReaderIsEmptyElement( reader ) )
+	return 1;
+
+    depth = xmlTextReaderDepth( reader );
+
+    while( ( ret = xmlTextReaderRead( reader ) ) == 1 ) {
+	type = xmlTextReaderNodeType( reader );
+
+	if( type == XML_READER_TYPE_ELEMENT ) {
+	    field = xmlTextReaderIsEmptyElement( reader ) ? TCX_FIELD_NONE :
+		trk_tcx_field( xmlTextReaderConstLocalName( reader ) );
+	} else if( type == XML_READER_TYPE_END_ELEMENT ) {
+	    if( xmlTextReaderDepth( reader ) == depth )
+		break;
+	    field = TCX_FIELD_NONE;
+	} else if( ( type == XML_READER_TYPE_TEXT ||
+		     type == XML_READER_TYPE_CDATA ) && field != TCX_FIELD_NONE ) {
+	    trk_parse_tcx_value( &point, field, xmlTextReaderConstValue( reader ) );
 	}
     }
 
-    if( speed )
-	*speed = spd;
+    if( ret != 1 ) {
+	trk_error( track, "can not parse XML" );
+	return 0;
+    }
+
+    if( !point.valid )
+	return 1;
+
+    if( !trk_add_point( track,
+			point.time,
+			point.latitude,
+			point.longitude,
+			point.altitude,
+			NAN,
+			point.speed,
+			-1,
+			-1,
+			NAN,
+			NAN,
+			NAN ) ) {
+	trk_error( track, "can not add point: %s", strerror( errno ) );
+	return 0;
+    }
 
     return 1;
 }
 
+static enum tcx_field trk_tcx_field( const xmlChar * name )
+{
+    if( !xmlStrcmp( name, ( const xmlChar * )"Time" ) )
+	return TCX_FIELD_TIME;
+    if( !xmlStrcmp( name, ( const xmlChar * )"LatitudeDegrees" ) )
+	return TCX_FIELD_LATITUDE;
+    if( !xmlStrcmp( name, ( const xmlChar * )"LongitudeDegrees" ) )
+	return TCX_FIELD_LONGITUDE;
+    if( !xmlStrcmp( name, ( const xmlChar * )"AltitudeMeters" ) )
+	return TCX_FIELD_ALTITUDE;
+    if( !xmlStrcmp( name, ( const xmlChar * )"Speed" ) )
+	return TCX_FIELD_SPEED;
+
+    return TCX_FIELD_NONE;
+}
+
+static void trk_parse_tcx_value( struct tcx_point * point,
+				 enum tcx_field     field,
+				 const xmlChar    * value )
+{
+    const char *val = ( const char * )value;
+    size_t len = xmlStrlen( value );
+
+    switch( field ) {
+    case TCX_FIELD_TIME:
+	/* points with unparsable time are skipped */
+	if( !trk_parse_isotime( val, len, &point->time ) )
+	    point->valid = 0;
+	break;
+    case TCX_FIELD_LATITUDE:
+	trk_parse_double( val, len, &point->latitude );
+	break;
+    case TCX_FIELD_LONGITUDE:
+	trk_parse_double( val, len, &point->longitude );
+	break;
+    case TCX_FIELD_ALTITUDE:
+	trk_parse_double( val, len, &point->altitude );
+	break;
+    case TCX_FIELD_SPEED:
+	trk_parse_double( val, len, &point->speed );
+	break;
+    case TCX_FIELD_NONE:
+	break;
+    }
+}
@@ -12,12 +12,12 @@
 #define TCX_H_INCLUDED
 
 
-#include <libxml/parser.h>
+#include <stddef.h>
 
 #include "track.h"
 
 
-int trk_parse_tcx( track_t track, xmlDocPtr doc, xmlNodePtr node );
+int trk_parse_tcx( track_t track, const void * data, size_t size );
 
 
 #endif
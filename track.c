@@ -9,7 +9,9 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
@@ -18,12 +20,15 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <math.h>
 #include <float.h>
 
+#ifdef HAVE_LIBMAGIC
 #include <magic.h>
+#endif
 
-#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 
 #include "geodesic.h"
 
@@ -33,13 +38,47 @@
 #include "gpx.h"
 #include "tcx.h"
 #include "nmea.h"
+#include "sniff.h"
+#include "snapshot.h"
+#include "live.h"
 
 
 
 static int trk_parse_data( track_t track, void * data, size_t size );
 static int trk_parse_xml( track_t track, void * data, size_t size );
-
-static char * trk_dump_point( point_t point );
+#ifdef HAVE_LIBMAGIC
+static int trk_parse_magic( track_t track, void * data, size_t size );
+#endif
+
+static void trk_global_init_once( void );
+
+static char * trk_dump_point( const struct points_o * p, size_t i, char * msg, size_t size );
+
+static int trk_get_coords( track_t         track,
+			   const time_t  * times,
+			   const int64_t * times_ns,
+			   size_t          n,
+			   double        * latitudes,
+			   double        * longitudes,
+			   double        * altitudes,
+			   double        * azimuths,
+			   double        * speeds );
+static const struct points_o * trk_read_begin( track_t           track,
+					       struct points_o * view,
+					       unsigned        * epoch );
+static void trk_read_end( track_t track, unsigned epoch );
+static void trk_out_of_range( track_t track, const struct points_o * p, int64_t time );
+static char * trk_format_time( int64_t time, char * buf, size_t size );
+static void trk_interpolate( track_t                          track,
+			     const struct points_o          * p,
+			     size_t                           i,
+			     int64_t                          time,
+			     const struct geod_geodesicline * line,
+			     double                         * latitude,
+			     double                         * longitude,
+			     double                         * altitude,
+			     double                         * azimuth,
+			     double                         * speed );
 
 static inline void trk_linear_interpolate( double   x1, double   y1,
 					   double   x2, double * y2,
@@ -55,13 +94,45 @@ struct track_o {
     log_hndl    out_hndl;
     void      * env;
 
-    time_t      start;
-    time_t      end;
-    point_t   * points;
-    size_t      npoints;
+    struct points_o        points;
+
+    struct geod_geodesic   geod;
+
+    unsigned               nmea_threads;
+    unsigned               nmea_sentences;
+
+    /* parse cache directory, "" for next to the files, NULL if none */
+    char                 * cache_dir;
+
+    /* entry of the track cache holding the track, NULL if none */
+    void                 * cache_entry;
+
+    /* published points of a live track, NULL if not live */
+    live_t                 live;
+
+    /* state of trk_nmea_feed(), NULL until fed */
+    struct nmea_feed     * nmea_feed;
 };
 
+struct cursor_o {
+    track_t                   track;
+    size_t                    seg;
 
+    /* geodesic line of segment line_seg, SIZE_MAX if none */
+    struct geod_geodesicline  line;
+    size_t                    line_seg;
+};
+
+
+
+static pthread_once_t trk_global_once = PTHREAD_ONCE_INIT;
+
+
+
+TU_EXPORT void trk_global_init( void )
+{
+    pthread_once( &trk_global_once, trk_global_init_once );
+}
 
 TU_EXPORT track_t trk_make( log_hndl   err_hndl,
 			    log_hndl   out_hndl,
@@ -69,6 +140,8 @@ TU_EXPORT track_t trk_make( log_hndl   err_hndl,
 {
     track_t track;
 
+    trk_global_init();
+
     track = malloc( sizeof( *track ) );
     if( !track )
 	return NULL;
@@ -76,10 +149,17 @@ TU_EXPORT track_t trk_make( log_hndl   err_hndl,
     track->err_hndl = err_hndl;
     track->out_hndl = out_hndl;
     track->env      = env;
-    track->start    = 0;
-    track->end      = 0;
-    track->points   = NULL;
-    track->npoints  = 0;
+
+    track->nmea_threads   = 1;
+    track->nmea_sentences = TRK_NMEA_DEFAULT;
+    track->cache_dir      = NULL;
+    track->cache_entry    = NULL;
+    track->live           = NULL;
+    track->nmea_feed      = NULL;
+
+    trk_points_init( &track->points );
+
+    geod_init( &track->geod, 6378137, 1 / 298.257223563 );
 
     return track;
 }
@@ -89,17 +169,21 @@ TU_EXPORT void trk_drop( track_t track )
     if( !track )
 	return;
 
-    while( track->npoints-- )
-	trk_point_free( track->points[track->npoints] );
-    free( track->points );
+    trk_live_drop( track->live );
+    trk_nmea_feed_free( track->nmea_feed );
+    trk_points_free( &track->points );
 
+    free( track->cache_dir );
     free( track );
 }
 
 TU_EXPORT int trk_from_file( track_t track, const char * file )
 {
     void * data;
-    size_t size;
+    size_t size, npoints;
+    struct stat st;
+    struct snapshot_key key;
+    char *sidecar = NULL;
     int fd;
     char msg[4096];
     int ret;
@@ -107,6 +191,11 @@ TU_EXPORT int trk_from_file( track_t track, const char * file )
     assert( track );
     assert( file );
 
+    if( track->live ) {
+	trk_error( track, "can not load '%s' into a live track", file );
+	return 0;
+    }
+
     fd = open( file, O_RDONLY, 0 );
     if( fd == -1 ) {
 	if( track->err_hndl ) {
@@ -133,10 +222,39 @@ TU_EXPORT int trk_from_file( track_t track, const char * file )
 	return 0;
     }
 
+    /* an entry made with other load options holds other points */
+    if( track->cache_dir && fstat( fd, &st ) == 0 ) {
+	memset( &key, 0, sizeof( key ) );
+	key.nmea_sentences = track->nmea_sentences;
+	key.compact        = track->points.compact;
+	sidecar = trk_sidecar_path( track->cache_dir, file,
+				    ( uint64_t )key.compact << 32 | key.nmea_sentences,
+				    &key.path_hash );
+	key.size  = size;
+	key.mtime = ( int64_t )st.st_mtim.tv_sec * TRK_NSEC_PER_SEC + st.st_mtim.tv_nsec;
+	key.hash  = trk_checksum( data, size, 0 );
+    }
+
     close( fd );
 
-    ret = trk_parse_data( track, data, size );
+    npoints = track->points.count;
+
+    if( sidecar && trk_read_snapshot( track, sidecar, SNAPSHOT_VERIFY | SNAPSHOT_QUIET, &key ) ) {
+	ret = 1;
+    } else {
+	ret = trk_parse_data( track, data, size );
+
+	/* a missing, stale or broken entry is replaced; points loaded
+	 * before would end up in it, so only loads into an empty track
+	 * are cached */
+	if( ret && sidecar && npoints == 0 ) {
+	    if( *track->cache_dir )
+		mkdir( track->cache_dir, 0777 );
+	    trk_write_snapshot( track, &track->points, sidecar, SNAPSHOT_QUIET, &key );
+	}
+    }
 
+    free( sidecar );
     munmap( data, size );
 
     return ret;
@@ -146,9 +264,209 @@ TU_EXPORT int trk_from_buffer( track_t track, void * buffer, size_t size )
 {
     assert( track );
 
+    if( track->live ) {
+	trk_error( track, "can not load a buffer into a live track" );
+	return 0;
+    }
+
     return trk_parse_data( track, buffer, size );
 }
 
+TU_EXPORT int trk_save_snapshot( track_t track, const char * path )
+{
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
+    int ret;
+
+    assert( track );
+    assert( path );
+
+    p = trk_read_begin( track, &view, &epoch );
+    ret = trk_write_snapshot( track, p, path, 0, NULL );
+    trk_read_end( track, epoch );
+
+    return ret;
+}
+
+TU_EXPORT int trk_from_snapshot( track_t track, const char * path )
+{
+    assert( track );
+    assert( path );
+
+    if( track->live ) {
+	trk_error( track, "can not load '%s' into a live track", path );
+	return 0;
+    }
+
+    return trk_read_snapshot( track, path, 0, NULL );
+}
+
+TU_EXPORT int trk_verify_snapshot( track_t track, const char * path )
+{
+    assert( track );
+    assert( path );
+
+    return trk_read_snapshot( track, path, SNAPSHOT_VERIFY | SNAPSHOT_CHECK, NULL );
+}
+
+TU_EXPORT int trk_set_cache_dir( track_t track, const char * dir )
+{
+    char *copy = NULL;
+
+    assert( track );
+
+    if( dir ) {
+	copy = strdup( dir );
+	if( !copy ) {
+	    trk_error( track, "can not set cache directory: %s", strerror( errno ) );
+	    return 0;
+	}
+    }
+
+    free( track->cache_dir );
+    track->cache_dir = copy;
+
+    return 1;
+}
+
+TU_EXPORT int trk_reserve( track_t track, size_t n )
+{
+    char msg[4096];
+
+    assert( track );
+
+    if( track->live ? n > track->points.capacity &&
+	!trk_live_grow( track->live, &track->points, n ) :
+	!trk_points_reserve( &track->points, n ) ) {
+	if( track->err_hndl ) {
+	    snprintf( msg, sizeof( msg ),
+		      "can not reserve %zu points: %s",
+		      n, strerror( errno ) );
+	    track->err_hndl( track->env, msg );
+	}
+	return 0;
+    }
+
+    return 1;
+}
+
+TU_EXPORT void trk_set_nmea_threads( track_t track, unsigned nthreads )
+{
+    long n;
+
+    assert( track );
+
+    if( nthreads == 0 ) {
+	n = sysconf( _SC_NPROCESSORS_ONLN );
+	nthreads = n > 0 ? ( unsigned )n : 1;
+    }
+
+    track->nmea_threads = nthreads;
+}
+
+TU_EXPORT void trk_set_nmea_sentences( track_t track, unsigned sentences )
+{
+    assert( track );
+
+    track->nmea_sentences = ( sentences & TRK_NMEA_DEFAULT ) | TRK_NMEA_RMC;
+}
+
+TU_EXPORT int trk_set_compact( track_t track, int compact )
+{
+    assert( track );
+
+    if( track->live || !trk_points_set_compact( &track->points, compact ) ) {
+	trk_error( track, "can not change point encoding of a loaded or live track" );
+	return 0;
+    }
+
+    return 1;
+}
+
+TU_EXPORT int trk_set_live( track_t track, int live )
+{
+    assert( track );
+
+    if( !live ) {
+	trk_live_drop( track->live );
+	track->live = NULL;
+	return 1;
+    }
+
+    if( track->live )
+	return 1;
+
+    track->live = trk_live_make( &track->points );
+    if( !track->live ) {
+	trk_error( track, "can not make track live: %s", strerror( ENOMEM ) );
+	return 0;
+    }
+
+    return 1;
+}
+
+TU_EXPORT int trk_append_point( track_t track,
+				int64_t time,
+				double  latitude,
+				double  longitude,
+				double  altitude,
+				double  azimuth,
+				double  speed,
+				int     nsat,
+				int     fix_type,
+				double  hdop,
+				double  vdop,
+				double  pdop )
+{
+    struct points_o *p = &track->points;
+    char tmbuf[2][64];
+    size_t n;
+
+    assert( track );
+
+    n = p->count;
+
+    if( isnan( latitude ) || isnan( longitude ) ) {
+	trk_error( track, "can not append a point without position" );
+	return 0;
+    }
+
+    if( n && time <= trk_point_time( p, n - 1 ) ) {
+	trk_error( track, "can not append point at %s: not after track end %s",
+		   trk_format_time( time, tmbuf[0], sizeof( tmbuf[0] ) ),
+		   trk_format_time( trk_point_time( p, n - 1 ),
+				    tmbuf[1], sizeof( tmbuf[1] ) ) );
+	return 0;
+    }
+
+    /* readers may be using the columns, so a live track never reallocates them */
+    if( track->live && n == p->capacity && !trk_live_grow( track->live, p, 0 ) ) {
+	trk_error( track, "can not append point: %s", strerror( ENOMEM ) );
+	return 0;
+    }
+
+    if( !trk_points_append( p, time, latitude, longitude, altitude, azimuth,
+			    speed, nsat, fix_type, hdop, vdop, pdop ) ) {
+	trk_error( track, "can not append point: %s", strerror( errno ) );
+	return 0;
+    }
+
+    trk_points_update_segments( p, &track->geod, n );
+
+    if( track->live ) {
+	/* the first point of a compact store sets the time origin */
+	if( n == 0 && p->compact && !trk_live_publish( track->live, p ) ) {
+	    p->count = n;
+	    trk_error( track, "can not append point: %s", strerror( ENOMEM ) );
+	    return 0;
+	}
+	trk_live_commit( track->live, p->count );
+    }
+
+    return 1;
+}
+
 TU_EXPORT int trk_get_coord_by_utime( track_t  track,
 				      time_t   time,
 				      double * latitude,
@@ -157,118 +475,184 @@ TU_EXPORT int trk_get_coord_by_utime( track_t  track,
 				      double * azimuth,
 				      double * speed )
 {
+    return trk_get_coord_by_utime_ns( track,
+				      ( int64_t )time * TRK_NSEC_PER_SEC,
+				      latitude,
+				      longitude,
+				      altitude,
+				      azimuth,
+				      speed );
+}
+
+TU_EXPORT int trk_get_coord_by_utime_ns( track_t  track,
+					 int64_t  time,
+					 double * latitude,
+					 double * longitude,
+					 double * altitude,
+					 double * azimuth,
+					 double * speed )
+{
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
     size_t i;
-    point_t cur_point, next_point;
-    double lat = 0., lng = 0., d = 0., alt = NAN, spd = NAN;
-    double a = 6378137, f = 1 / 298.257223563;
-    double az11, az12, s12;
-    struct geod_geodesic g;
+    int ret = 0;
 
     assert( track );
 
-    if( time < track->start || time > track->end ) {
-	if( track->err_hndl ) {
-	    struct tm *tm;
-	    char tmbuf[3][64];
-	    char msg[4096];
-
-	    tm = localtime( &time );
-	    strftime( tmbuf[0], sizeof( tmbuf[0] ), "%FT%TZ", tm );
-	    tm = localtime( &track->start );
-	    strftime( tmbuf[1], sizeof( tmbuf[1] ), "%FT%TZ", tm );
-	    tm = localtime( &track->end );
-	    strftime( tmbuf[2], sizeof( tmbuf[2] ), "%FT%TZ", tm );
+    p = trk_read_begin( track, &view, &epoch );
 
-	    snprintf( msg, sizeof( msg ),
-		      "time %s is out of track range [%s - %s]",
-		      tmbuf[0], tmbuf[1], tmbuf[2] );
-	    track->err_hndl( track->env, msg );
-	}
+    if( p->count == 0 ) {
+	/* nothing loaded */
+    } else if( time < trk_point_time( p, 0 ) || time > trk_point_time( p, p->count - 1 ) ) {
+	trk_out_of_range( track, p, time );
+    } else {
+	i = trk_points_lower_bound( p, time );
 
-	return 0;
+	trk_interpolate( track, p, i, time, NULL,
+			 latitude, longitude, altitude, azimuth, speed );
+	ret = 1;
     }
 
-    geod_init( &g, a, f );
+    trk_read_end( track, epoch );
 
-    for( i = 0; i < track->npoints; i++ ) {
-	cur_point = track->points[i];
+    return ret;
+}
 
-	if( time == cur_point->time ) {
-	    lat = cur_point->latitude;
-	    lng = cur_point->longitude;
-	    alt = cur_point->altitude;
-	    az11 = cur_point->azimuth;
-	    spd = cur_point->speed;
+TU_EXPORT int trk_get_coords_by_utimes( track_t        track,
+					const time_t * times,
+					size_t         n,
+					double       * latitudes,
+					double       * longitudes,
+					double       * altitudes,
+					double       * azimuths,
+					double       * speeds )
+{
+    assert( track );
+    assert( times || n == 0 );
 
-	    if( isnan( az11 ) ) {
-		next_point = track->points[i+1];
-		if( next_point ) {
-		    geod_inverse( &g, cur_point->latitude, cur_point->longitude,
-				  next_point->latitude, next_point->longitude,
-				  &s12, &az11, &az12 );
-		}
-	    }
+    return trk_get_coords( track, times, NULL, n,
+			   latitudes, longitudes, altitudes, azimuths, speeds );
+}
 
-	    if( isnan( spd ) ) {
-		next_point = track->points[i+1];
-		if( next_point ) {
-		    geod_inverse( &g, cur_point->latitude, cur_point->longitude,
-				  next_point->latitude, next_point->longitude,
-				  &s12, &az11, &az12 );
+TU_EXPORT int trk_get_coords_by_utimes_ns( track_t         track,
+					   const int64_t * times,
+					   size_t          n,
+					   double        * latitudes,
+					   double        * longitudes,
+					   double        * altitudes,
+					   double        * azimuths,
+					   double        * speeds )
+{
+    assert( track );
+    assert( times || n == 0 );
 
-		    spd = s12 / ( double )( next_point->time - cur_point->time );
-		}
-	    }
+    return trk_get_coords( track, NULL, times, n,
+			   latitudes, longitudes, altitudes, azimuths, speeds );
+}
 
-	    if( az11 < 0. )
-		az11 += 360.;
+TU_EXPORT trk_cursor_t trk_cursor_make( track_t track )
+{
+    trk_cursor_t cursor;
 
-	    break;
-	}
+    assert( track );
 
-	next_point = track->points[i+1];
+    cursor = malloc( sizeof( *cursor ) );
+    if( !cursor )
+	return NULL;
 
-	if( next_point && time < next_point->time ) {
-	    geod_inverse( &g, cur_point->latitude, cur_point->longitude,
-			  next_point->latitude, next_point->longitude,
-			  &s12, &az11, &az12 );
+    cursor->track    = track;
+    cursor->seg      = 0;
+    cursor->line_seg = SIZE_MAX;
 
-	    trk_linear_interpolate( ( double )cur_point->time,  cur_point->altitude,
-				    ( double )time,             &alt,
-				    ( double )next_point->time, next_point->altitude );
+    return cursor;
+}
 
-	    if( isnan( cur_point->speed ) || isnan( next_point->speed ) ) {
-		trk_linear_interpolate( ( double )cur_point->time,  0.,
-					( double )time,             &d,
-					( double )next_point->time, s12 );
+TU_EXPORT void trk_cursor_drop( trk_cursor_t cursor )
+{
+    free( cursor );
+}
 
-		spd = s12 / ( double )( next_point->time - cur_point->time );
-	    } else {
-		trk_ac_interpolate( ( double )cur_point->time,  0.,  cur_point->speed,
-				    ( double )time,             &d,  &spd,
-				    ( double )next_point->time, s12, next_point->speed );
-	    }
+TU_EXPORT int trk_cursor_get_coord_by_utime( trk_cursor_t   cursor,
+					     time_t         time,
+					     double       * latitude,
+					     double       * longitude,
+					     double       * altitude,
+					     double       * azimuth,
+					     double       * speed )
+{
+    return trk_cursor_get_coord_by_utime_ns( cursor,
+					     ( int64_t )time * TRK_NSEC_PER_SEC,
+					     latitude,
+					     longitude,
+					     altitude,
+					     azimuth,
+					     speed );
+}
 
-	    if( az11 < 0. )
-		az11 += 360.;
+TU_EXPORT int trk_cursor_get_coord_by_utime_ns( trk_cursor_t   cursor,
+						int64_t        time,
+						double       * latitude,
+						double       * longitude,
+						double       * altitude,
+						double       * azimuth,
+						double       * speed )
+{
+    track_t track;
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
+    size_t i, s, n;
+    double az1;
 
-	    geod_direct( &g, cur_point->latitude, cur_point->longitude, az11, d,
-			 &lat, &lng, &az12 );
+    assert( cursor );
 
-	    break;
-	}
+    track = cursor->track;
+    p = trk_read_begin( track, &view, &epoch );
+    n = p->count;
+
+    if( n == 0 ) {
+	trk_read_end( track, epoch );
+	return 0;
     }
 
-    if( latitude )
-	*latitude = lat;
-    if( longitude )
-	*longitude = lng;
-    if( altitude )
-	*altitude = alt;
-    if( azimuth )
-	*azimuth = az11;
-    if( speed )
-	*speed = spd;
+    if( time < trk_point_time( p, 0 ) || time > trk_point_time( p, n - 1 ) ) {
+	trk_out_of_range( track, p, time );
+	trk_read_end( track, epoch );
+	return 0;
+    }
+
+    /* try the last segment and the next one before searching */
+    s = cursor->seg;
+    if( s + 1 < n && trk_point_time( p, s ) < time && time <= trk_point_time( p, s + 1 ) )
+	i = s + 1;
+    else if( s + 2 < n && trk_point_time( p, s + 1 ) < time &&
+	     time <= trk_point_time( p, s + 2 ) )
+	i = s + 2;
+    else
+	i = trk_points_lower_bound( p, time );
+
+    cursor->seg = i > 0 ? i - 1 : 0;
+
+    if( time == trk_point_time( p, i ) ) {
+	trk_interpolate( track, p, i, time, NULL,
+			 latitude, longitude, altitude, azimuth, speed );
+	trk_read_end( track, epoch );
+	return 1;
+    }
+
+    if( cursor->line_seg != i - 1 ) {
+	trk_points_segment( p, &track->geod, i - 1, NULL, &az1, NULL );
+	geod_lineinit( &cursor->line, &track->geod,
+		       trk_point_latitude( p, i - 1 ), trk_point_longitude( p, i - 1 ),
+		       az1, 0 );
+	cursor->line_seg = i - 1;
+    }
+
+    trk_interpolate( track, p, i, time, &cursor->line,
+		     latitude, longitude, altitude, azimuth, speed );
+
+    trk_read_end( track, epoch );
 
     return 1;
 }
@@ -281,23 +665,28 @@ TU_EXPORT int trk_get_coord_by_ISOdate( track_t      track,
 					double     * azimuth,
 					double     * speed )
 {
-    time_t time;
-    struct tm tm;
+    int64_t time;
+    char msg[4096];
 
     assert( track );
     assert( date );
 
-    strptime( date, "%FT%TZ", &tm );
-    tm.tm_isdst = -1;
-    time = mktime( &tm );
+    if( !trk_parse_isotime( date, strlen( date ), &time ) ) {
+	if( track->err_hndl ) {
+	    snprintf( msg, sizeof( msg ),
+		      "invalid ISO 8601 datetime: '%s'", date );
+	    track->err_hndl( track->env, msg );
+	}
+	return 0;
+    }
 
-    return trk_get_coord_by_utime( track,
-				   time,
-				   latitude,
-				   longitude,
-				   altitude,
-				   azimuth,
-				   speed );
+    return trk_get_coord_by_utime_ns( track,
+				      time,
+				      latitude,
+				      longitude,
+				      altitude,
+				      azimuth,
+				      speed );
 }
 
 TU_EXPORT int trk_get_track_summary( track_t  track,
@@ -310,58 +699,62 @@ TU_EXPORT int trk_get_track_summary( track_t  track,
 				     double * min_altitude,
 				     double * max_altitude )
 {
-    size_t i;
-    point_t cur_point, next_point;
-    double s12, d = 0., avg_spd,
+    size_t i, n;
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
+    int64_t t1 = 0, t2 = 0;
+    double d = 0., s12, spd, alt, avg_spd,
 	min_spd = DBL_MAX, max_spd = DBL_MIN,
 	min_alt = DBL_MAX, max_alt = DBL_MIN;
-    double a = 6378137, f = 1 / 298.257223563;
-    struct geod_geodesic g;
 
     assert( track );
 
-    geod_init( &g, a, f );
+    p = trk_read_begin( track, &view, &epoch );
+    n = p->count;
 
-    for( i = 0; i < track->npoints; i++ ) {
-	cur_point = track->points[i];
+    if( n ) {
+	t1 = trk_point_time( p, 0 );
+	t2 = trk_point_time( p, n - 1 );
+    }
 
-	if( !isnan( cur_point->speed ) ) {
-	    if( cur_point->speed < min_spd )
-		min_spd = cur_point->speed;
-	    if( cur_point->speed > max_spd )
-		max_spd = cur_point->speed;
+    for( i = 0; i < n; i++ ) {
+	spd = trk_point_speed( p, i );
+	if( !isnan( spd ) ) {
+	    if( spd < min_spd )
+		min_spd = spd;
+	    if( spd > max_spd )
+		max_spd = spd;
 	}
 
-	if( !isnan( cur_point->altitude ) ) {
-	    if( cur_point->altitude < min_alt )
-		min_alt = cur_point->altitude;
-	    if( cur_point->altitude > max_alt )
-		max_alt = cur_point->altitude;
+	alt = trk_point_altitude( p, i );
+	if( !isnan( alt ) ) {
+	    if( alt < min_alt )
+		min_alt = alt;
+	    if( alt > max_alt )
+		max_alt = alt;
 	}
 
-	if( i < track->npoints - 1 ) {
-	    next_point = track->points[i+1];
-	    if( next_point ) {
-		geod_inverse( &g, cur_point->latitude, cur_point->longitude,
-			      next_point->latitude, next_point->longitude,
-			      &s12, NULL, NULL );
+    }
 
-		d += s12;
-	    }
-	}
+    for( i = 0; i + 1 < n; i++ ) {
+	trk_points_segment( p, &track->geod, i, &s12, NULL, NULL );
+	d += s12;
     }
 
+    trk_read_end( track, epoch );
+
     if( min_spd == DBL_MAX && max_spd == DBL_MIN )
-	avg_spd = d / ( double )( track->end - track->start );
+	avg_spd = d / ( ( double )( t2 - t1 ) * 1e-9 );
     else
 	avg_spd = ( min_spd + max_spd ) / 2;
 
     if( npoints )
-	*npoints = track->npoints;
+	*npoints = n;
     if( start )
-	*start = track->start;
+	*start = trk_floor_sec( t1 );
     if( end )
-	*end = track->end;
+	*end = trk_floor_sec( t2 );
     if( distance )
 	*distance = d;
     if( min_speed )
@@ -378,45 +771,109 @@ TU_EXPORT int trk_get_track_summary( track_t  track,
 
 TU_EXPORT int trk_dump_track( track_t track )
 {
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
     size_t i;
-    point_t point;
+    char msg[4096];
 
     assert( track );
 
-    for( i = 0; i < track->npoints; i++ ) {
-	point = track->points[i];
+    p = trk_read_begin( track, &view, &epoch );
 
+    for( i = 0; i < p->count; i++ ) {
 	if( track->out_hndl ) {
 	    track->out_hndl( track->env,
-			     trk_dump_point( point ) );
+			     trk_dump_point( p, i, msg, sizeof( msg ) ) );
 	}
     }
 
+    trk_read_end( track, epoch );
+
     return 1;
 }
 
-static char * trk_dump_point( point_t point )
+static char * trk_dump_point( const struct points_o * p, size_t i, char * msg, size_t size )
 {
-    struct tm *tm;
     char tmbuf[64];
-    static char msg[4096];
 
-    tm = localtime( &point->time );
-    strftime( tmbuf, sizeof( tmbuf ), "%FT%TZ", tm );
+    trk_format_time( trk_point_time( p, i ), tmbuf, sizeof( tmbuf ) );
 
-    snprintf( msg, sizeof( msg ),
+    snprintf( msg, size,
 	      "[%s]  lattitude: %.6lf, longitude: %.6lf, "		\
 	      "altitude: %.6lf, azimuth: %.6lf, speed: %.6lf, "		\
 	      "satellites: %d, fix: %d, HDOP: %.6lf, VDOP: %.6lf, PDOP: %.6lf",
-	      tmbuf, point->latitude, point->longitude,
-	      point->altitude, point->azimuth, point->speed,
-	      point->nsat, point->fix_type, point->hdop, point->vdop, point->pdop);
+	      tmbuf, trk_point_latitude( p, i ), trk_point_longitude( p, i ),
+	      trk_point_altitude( p, i ), trk_point_azimuth( p, i ),
+	      trk_point_speed( p, i ), trk_point_nsat( p, i ),
+	      trk_point_fix_type( p, i ), trk_point_hdop( p, i ),
+	      trk_point_vdop( p, i ), trk_point_pdop( p, i ) );
 
     return msg;
 }
 
+/*
+ * Library state shared by all tracks: the geodesic constants are set up
+ * by the first geod_init() and libxml2 must be initialized before
+ * readers run in several threads.
+ */
+static void trk_global_init_once( void )
+{
+    struct geod_geodesic geod;
+
+    geod_init( &geod, 6378137, 1 / 298.257223563 );
+
+    LIBXML_TEST_VERSION;
+    xmlInitParser();
+}
+
 
 static int trk_parse_data( track_t track, void * data, size_t size )
+{
+    const char *name;
+    int ret;
+    char msg[4096];
+
+    switch( trk_sniff_format( data, size, &name ) ) {
+    case TRK_FORMAT_GPX:
+	ret = trk_parse_gpx( track, data, size );
+	break;
+    case TRK_FORMAT_TCX:
+	ret = trk_parse_tcx( track, data, size );
+	break;
+    case TRK_FORMAT_XML:
+	ret = trk_parse_xml( track, data, size );
+	break;
+    case TRK_FORMAT_NMEA:
+	ret = trk_parse_nmea( track, data, size );
+	break;
+#ifdef HAVE_LIBMAGIC
+    case TRK_FORMAT_UNKNOWN:
+	ret = trk_parse_magic( track, data, size );
+	break;
+#endif
+    default:
+	if( track->err_hndl ) {
+	    snprintf( msg, sizeof( msg ),
+		      "format is not supported: '%s'",
+		      name ? name : "unknown" );
+	    track->err_hndl( track->env, msg );
+	}
+	ret = 0;
+	break;
+    }
+
+    if( ret )
+	ret = trk_finalize( track );
+
+    return ret;
+}
+
+#ifdef HAVE_LIBMAGIC
+/*
+ * Fallback for data the built-in sniffer does not recognize.
+ */
+static int trk_parse_magic( track_t track, void * data, size_t size )
 {
     const char *mime;
     magic_t magic;
@@ -473,69 +930,308 @@ static int trk_parse_data( track_t track, void * data, size_t size )
 
     magic_close( magic );
 
-    if( track->npoints == 0 ) {
+    return ret;
+}
+#endif
+
+/*
+ * Finalize loaded points: order them by time, drop points without
+ * position, merge points sharing a time and release unused storage,
+ * then cache the geodesic of every segment. Queries rely on a sorted,
+ * dense time column.
+ */
+int trk_finalize( track_t track )
+{
+    const struct points_o *p = &track->points;
+    char msg[4096];
+
+    if( !trk_points_sort( &track->points ) ) {
+	if( track->err_hndl ) {
+	    snprintf( msg, sizeof( msg ),
+		      "can not sort track points: %s",
+		      strerror( errno ) );
+	    track->err_hndl( track->env, msg );
+	}
+	return 0;
+    }
+
+    trk_points_compact( &track->points );
+    trk_points_shrink( &track->points );
+
+    if( p->count == 0 ) {
 	if( track->err_hndl ) {
 	    snprintf( msg, sizeof( msg ),
 		      "No valid points found" );
 	    track->err_hndl( track->env, msg );
 	}
-	ret = 0;
+	return 0;
     }
 
-    return ret;
+    trk_points_update_segments( &track->points, &track->geod, 0 );
+
+    return 1;
 }
 
+/*
+ * XML whose root element was not recognized by the sniffer: read up to
+ * the root element only and dispatch on its local name.
+ */
 static int trk_parse_xml( track_t track, void * data, size_t size )
 {
-    xmlDocPtr doc;
-    xmlNodePtr root;
+    xmlTextReaderPtr reader;
+    xmlChar *name = NULL;
     char msg[4096];
-    int ret;
-
-    LIBXML_TEST_VERSION;
-
-    doc = xmlReadMemory( ( const char * )data,
-			 size, "XML", NULL, 0 );
-    if( !doc ) {
-	if( track->err_hndl ) {
-	    snprintf( msg, sizeof( msg ),
-		      "can not parse XML" );
-	    track->err_hndl( track->env, msg );
+    int ret = -1;
+
+    reader = xmlReaderForMemory( ( const char * )data, size,
+				 NULL, NULL, XML_PARSE_NONET );
+    if( reader ) {
+	while( ( ret = xmlTextReaderRead( reader ) ) == 1 ) {
+	    if( xmlTextReaderNodeType( reader ) == XML_READER_TYPE_ELEMENT ) {
+		name = xmlTextReaderLocalName( reader );
+		break;
+	    }
 	}
-        return 0;
+	xmlFreeTextReader( reader );
     }
 
-    root = xmlDocGetRootElement( doc );
-    if( !root ) {
+    if( !name ) {
 	if( track->err_hndl ) {
 	    snprintf( msg, sizeof( msg ),
-		      "empty XML" );
+		      ret == 0 ? "empty XML" : "can not parse XML" );
 	    track->err_hndl( track->env, msg );
 	}
-        xmlFreeDoc( doc );
         return 0;
     }
 
-    if( !xmlStrcmp( root->name, ( const xmlChar * )"gpx" ) ) {
-	ret = trk_parse_gpx( track, doc, root );
-    } else if( !xmlStrcmp( root->name, ( const xmlChar * )"TrainingCenterDatabase" ) ) {
-	ret = trk_parse_tcx( track, doc, root );
+    if( !xmlStrcmp( name, ( const xmlChar * )"gpx" ) ) {
+	ret = trk_parse_gpx( track, data, size );
+    } else if( !xmlStrcmp( name, ( const xmlChar * )"TrainingCenterDatabase" ) ) {
+	ret = trk_parse_tcx( track, data, size );
     } else {
 	if( track->err_hndl ) {
 	    snprintf( msg, sizeof( msg ),
-		      "XML type is not supported: '%s'", root->name );
+		      "XML type is not supported: '%s'", name );
 	    track->err_hndl( track->env, msg );
 	}
 	ret = 0;
     }
 
-    xmlFreeDoc( doc );
+    xmlFree( name );
 
     return ret;
 }
 
+/*
+ * Days since the Epoch of a proleptic Gregorian date.
+ */
+static int64_t trk_days_from_civil( int64_t y, int m, int d )
+{
+    int64_t era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = ( y >= 0 ? y : y - 399 ) / 400;
+    yoe = y - era * 400;
+    doy = ( 153 * ( m + ( m > 2 ? -3 : 9 ) ) + 2 ) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * Read exactly n digits.
+ */
+static int trk_parse_digits( const char ** str, const char * end, int n, int * value )
+{
+    const char *p = *str;
+    int v = 0;
+
+    if( end - p < n )
+	return 0;
+
+    for( ; n > 0; n--, p++ ) {
+	if( *p < '0' || *p > '9' )
+	    return 0;
+	v = v * 10 + ( *p - '0' );
+    }
+
+    *str = p;
+    *value = v;
+
+    return 1;
+}
+
+static int trk_expect( const char ** str, const char * end, char c )
+{
+    if( *str == end || **str != c )
+	return 0;
+
+    ( *str )++;
+
+    return 1;
+}
+
+/*
+ * Parse ISO 8601 datetime YYYY-MM-DDThh:mm:ss[.f...][Z|(+|-)hh[[:]mm]]
+ * from [str, str + len) into nanoseconds since the Epoch. Time without
+ * a zone is taken as UTC, extra fraction digits beyond nanoseconds are
+ * ignored, surrounding white space is allowed.
+ */
+int trk_parse_isotime( const char * str, size_t len, int64_t * time )
+{
+    static const int mdays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const char *p = str, *end = str + len;
+    int year, mon, day, hour, min, sec, oh, om = 0, sign;
+    int64_t nsec = 0, scale = TRK_NSEC_PER_SEC, secs;
+
+#define AT( p ) ( ( p ) < end ? *( p ) : '\0' )
+
+    while( p < end && ( *p == ' ' || ( *p >= '\t' && *p <= '\r' ) ) )
+	p++;
+    while( end > p && ( end[-1] == ' ' || ( end[-1] >= '\t' && end[-1] <= '\r' ) ) )
+	end--;
+
+    if( !trk_parse_digits( &p, end, 4, &year ) || !trk_expect( &p, end, '-' ) ||
+	!trk_parse_digits( &p, end, 2, &mon )  || !trk_expect( &p, end, '-' ) ||
+	!trk_parse_digits( &p, end, 2, &day ) )
+	return 0;
+
+    if( AT( p ) != 'T' && AT( p ) != 't' && AT( p ) != ' ' )
+	return 0;
+    p++;
+
+    if( !trk_parse_digits( &p, end, 2, &hour ) || !trk_expect( &p, end, ':' ) ||
+	!trk_parse_digits( &p, end, 2, &min )  || !trk_expect( &p, end, ':' ) ||
+	!trk_parse_digits( &p, end, 2, &sec ) )
+	return 0;
+
+    if( mon < 1 || mon > 12 || day < 1 || day > mdays[mon - 1] ||
+	( mon == 2 && day == 29 &&
+	  ( year % 4 || ( year % 100 == 0 && year % 400 ) ) ) ||
+	hour > 23 || min > 59 || sec > 60 )
+	return 0;
+
+    if( AT( p ) == '.' || AT( p ) == ',' ) {
+	if( AT( p + 1 ) < '0' || AT( p + 1 ) > '9' )
+	    return 0;
+	for( p++; AT( p ) >= '0' && AT( p ) <= '9'; p++ ) {
+	    if( scale > 1 ) {
+		scale /= 10;
+		nsec += ( *p - '0' ) * scale;
+	    }
+	}
+    }
+
+    secs = ( trk_days_from_civil( year, mon, day ) * 24 + hour ) * 60 * 60 +
+	min * 60 + sec;
+
+    if( AT( p ) == 'Z' || AT( p ) == 'z' ) {
+	p++;
+    } else if( AT( p ) == '+' || AT( p ) == '-' ) {
+	sign = *p++ == '+' ? 1 : -1;
+	if( !trk_parse_digits( &p, end, 2, &oh ) )
+	    return 0;
+	if( AT( p ) == ':' ) {
+	    p++;
+	    if( !trk_parse_digits( &p, end, 2, &om ) )
+		return 0;
+	} else if( p < end ) {
+	    if( !trk_parse_digits( &p, end, 2, &om ) )
+		return 0;
+	}
+	if( oh > 23 || om > 59 )
+	    return 0;
+	secs -= sign * ( oh * 60 + om ) * 60;
+    }
+
+#undef AT
+
+    if( p != end )
+	return 0;
+
+    /* nanoseconds since the Epoch cover years 1678 to 2261 */
+    if( secs < INT64_MIN / TRK_NSEC_PER_SEC + 1 || secs > INT64_MAX / TRK_NSEC_PER_SEC - 1 )
+	return 0;
+
+    *time = secs * TRK_NSEC_PER_SEC + nsec;
+
+    return 1;
+}
+
+void trk_error( track_t track, const char * fmt, ... )
+{
+    char msg[4096];
+    va_list ap;
+
+    if( !track->err_hndl )
+	return;
+
+    va_start( ap, fmt );
+    vsnprintf( msg, sizeof( msg ), fmt, ap );
+    va_end( ap );
+
+    track->err_hndl( track->env, msg );
+}
+
+size_t trk_get_npoints( track_t track )
+{
+    return track->points.count;
+}
+
+struct points_o * trk_get_points( track_t track )
+{
+    return &track->points;
+}
+
+unsigned trk_get_nmea_threads( track_t track )
+{
+    return track->nmea_threads;
+}
+
+unsigned trk_get_nmea_sentences( track_t track )
+{
+    return track->nmea_sentences;
+}
+
+/*
+ * Drop the points added by a failed load; points loaded before it
+ * were finalized.
+ */
+void trk_truncate( track_t track, size_t npoints )
+{
+    struct points_o *p = &track->points;
+
+    if( npoints < p->count )
+	p->count = npoints;
+}
+
+size_t trk_get_memory( track_t track )
+{
+    return sizeof( *track ) + trk_points_memory( &track->points );
+}
+
+struct nmea_feed * trk_get_nmea_feed( track_t track )
+{
+    return track->nmea_feed;
+}
+
+void trk_set_nmea_feed( track_t track, struct nmea_feed * feed )
+{
+    track->nmea_feed = feed;
+}
+
+void trk_set_cache_entry( track_t track, void * entry )
+{
+    track->cache_entry = entry;
+}
+
+void * trk_get_cache_entry( track_t track )
+{
+    return track->cache_entry;
+}
+
 int trk_add_point( track_t track,
-		   time_t  time,
+		   int64_t time,
 		   double  latitude,
 		   double  longitude,
 		   double  altitude,
@@ -547,40 +1243,242 @@ int trk_add_point( track_t track,
 		   double  vdop,
 		   double  pdop )
 {
-    point_t point;
-
-    point = trk_point_make( time,
-			    latitude,
-			    longitude,
-			    altitude,
-			    azimuth,
-			    speed,
-			    nsat,
-			    fix_type,
-			    hdop,
-			    vdop,
-			    pdop );
-    if( !point )
-	return 0;
+    return trk_points_append( &track->points,
+			      time,
+			      latitude,
+			      longitude,
+			      altitude,
+			      azimuth,
+			      speed,
+			      nsat,
+			      fix_type,
+			      hdop,
+			      vdop,
+			      pdop );
+}
 
-    track->points = realloc( track->points, ++track->npoints * sizeof( point ) );
-    if( !track->points ) {
-	track->npoints--;
-	trk_point_free( point );
-	return 0;
+
+static int trk_get_coords( track_t         track,
+			   const time_t  * times,
+			   const int64_t * times_ns,
+			   size_t          n,
+			   double        * latitudes,
+			   double        * longitudes,
+			   double        * altitudes,
+			   double        * azimuths,
+			   double        * speeds )
+{
+    size_t i, k, npoints, nfailed = 0;
+    const struct points_o *p;
+    struct points_o view;
+    unsigned epoch;
+    int64_t time, prev = INT64_MIN, start = 0, end = 0;
+
+    p = trk_read_begin( track, &view, &epoch );
+    npoints = p->count;
+
+    if( npoints ) {
+	start = trk_point_time( p, 0 );
+	end   = trk_point_time( p, npoints - 1 );
     }
-    track->points[track->npoints - 1] = point;
 
-    if( track->start == 0 ) {
-	track->start = time;
-	track->end = time;
-    } else if( time < track->start ) {
-	track->start = time;
-    } else if( time > track->end ) {
-	track->end = time;
+    for( i = 0, k = 0; k < n; k++ ) {
+	time = times ? ( int64_t )times[k] * TRK_NSEC_PER_SEC : times_ns[k];
+
+	if( npoints == 0 || time < start || time > end ) {
+	    if( nfailed++ == 0 && npoints )
+		trk_out_of_range( track, p, time );
+
+	    if( latitudes )
+		latitudes[k] = NAN;
+	    if( longitudes )
+		longitudes[k] = NAN;
+	    if( altitudes )
+		altitudes[k] = NAN;
+	    if( azimuths )
+		azimuths[k] = NAN;
+	    if( speeds )
+		speeds[k] = NAN;
+	    continue;
+	}
+
+	/* merge step from the last time within range; times going
+	 * backwards fall back to a search */
+	if( time < prev ) {
+	    i = trk_points_lower_bound( p, time );
+	} else {
+	    while( trk_point_time( p, i ) < time )
+		i++;
+	}
+	prev = time;
+
+	trk_interpolate( track, p, i, time, NULL,
+			 latitudes  ? &latitudes[k]  : NULL,
+			 longitudes ? &longitudes[k] : NULL,
+			 altitudes  ? &altitudes[k]  : NULL,
+			 azimuths   ? &azimuths[k]   : NULL,
+			 speeds     ? &speeds[k]     : NULL );
     }
 
-    return 1;
+    trk_read_end( track, epoch );
+
+    return nfailed == 0;
+}
+
+/*
+ * Points a query works on. A live track gives a copy of its published
+ * points, valid until trk_read_end(); the writer keeps appending.
+ */
+static const struct points_o * trk_read_begin( track_t           track,
+					       struct points_o * view,
+					       unsigned        * epoch )
+{
+    *epoch = 0;
+
+    if( !track->live )
+	return &track->points;
+
+    return trk_live_enter( track->live, view, epoch );
+}
+
+static void trk_read_end( track_t track, unsigned epoch )
+{
+    if( track->live )
+	trk_live_leave( track->live, epoch );
+}
+
+static void trk_out_of_range( track_t track, const struct points_o * p, int64_t time )
+{
+    char tmbuf[3][64];
+    char msg[4096];
+
+    if( !track->err_hndl )
+	return;
+
+    snprintf( msg, sizeof( msg ),
+	      "time %s is out of track range [%s - %s]",
+	      trk_format_time( time, tmbuf[0], sizeof( tmbuf[0] ) ),
+	      trk_format_time( trk_point_time( p, 0 ), tmbuf[1], sizeof( tmbuf[1] ) ),
+	      trk_format_time( trk_point_time( p, p->count - 1 ),
+			       tmbuf[2], sizeof( tmbuf[2] ) ) );
+    track->err_hndl( track->env, msg );
+}
+
+/*
+ * ISO 8601 representation of a nanosecond time; the fraction of
+ * a second is printed only when there is one.
+ */
+static char * trk_format_time( int64_t time, char * buf, size_t size )
+{
+    time_t sec;
+    long nsec;
+    struct tm tm;
+    size_t len;
+    int digits;
+
+    sec = trk_floor_sec( time );
+    nsec = ( long )( time - ( int64_t )sec * TRK_NSEC_PER_SEC );
+
+    len = strftime( buf, size, "%FT%T", gmtime_r( &sec, &tm ) );
+
+    if( nsec ) {
+	for( digits = 9; nsec % 10 == 0; digits-- )
+	    nsec /= 10;
+	len += snprintf( buf + len, size - len, ".%0*ld", digits, nsec );
+    }
+
+    snprintf( buf + len, size - len, "Z" );
+
+    return buf;
+}
+
+/*
+ * Coordinates at given time; i is the index of the first point at or
+ * after it, and time must be within the track range. If given, line is
+ * the geodesic line of segment [i-1, i].
+ */
+static void trk_interpolate( track_t                          track,
+			     const struct points_o          * p,
+			     size_t                           i,
+			     int64_t                          time,
+			     const struct geod_geodesicline * line,
+			     double                         * latitude,
+			     double                         * longitude,
+			     double                         * altitude,
+			     double                         * azimuth,
+			     double                         * speed )
+{
+    size_t n = p->count;
+    double lat = 0., lng = 0., d = 0., alt = NAN, spd = NAN;
+    double az11 = NAN, az12, s12, seg_az, seg_spd, spd1, spd2, t, dt;
+    int64_t t1;
+
+    t1 = trk_point_time( p, i );
+
+    if( time == t1 ) {
+	lat = trk_point_latitude( p, i );
+	lng = trk_point_longitude( p, i );
+	alt = trk_point_altitude( p, i );
+	az11 = trk_point_azimuth( p, i );
+	spd = trk_point_speed( p, i );
+
+	if( ( isnan( az11 ) || isnan( spd ) ) && i + 1 < n ) {
+	    trk_points_segment( p, &track->geod, i, NULL, &seg_az, &seg_spd );
+	    if( isnan( az11 ) )
+		az11 = seg_az;
+	    if( isnan( spd ) )
+		spd = seg_spd;
+	}
+    } else {
+	/* time(i-1) < time < time(i), so the segment is [i-1, i] */
+	i--;
+
+	trk_points_segment( p, &track->geod, i, &s12, &az11, &seg_spd );
+
+	/* seconds from the segment start; absolute nanoseconds do not fit a double */
+	t = ( double )( time - trk_point_time( p, i ) ) * 1e-9;
+	dt = ( double )( t1 - trk_point_time( p, i ) ) * 1e-9;
+
+	trk_linear_interpolate( 0., trk_point_altitude( p, i ),
+				t,  &alt,
+				dt, trk_point_altitude( p, i + 1 ) );
+
+	spd1 = trk_point_speed( p, i );
+	spd2 = trk_point_speed( p, i + 1 );
+
+	if( isnan( spd1 ) || isnan( spd2 ) ) {
+	    trk_linear_interpolate( 0., 0.,
+				    t,  &d,
+				    dt, s12 );
+
+	    spd = seg_spd;
+	} else {
+	    trk_ac_interpolate( 0., 0.,  spd1,
+				t,  &d,  &spd,
+				dt, s12, spd2 );
+	}
+
+	if( line )
+	    geod_position( line, d, &lat, &lng, &az12 );
+	else
+	    geod_direct( &track->geod, trk_point_latitude( p, i ),
+			 trk_point_longitude( p, i ), az11, d,
+			 &lat, &lng, &az12 );
+    }
+
+    if( az11 < 0. )
+	az11 += 360.;
+
+    if( latitude )
+	*latitude = lat;
+    if( longitude )
+	*longitude = lng;
+    if( altitude )
+	*altitude = alt;
+    if( azimuth )
+	*azimuth = az11;
+    if( speed )
+	*speed = spd;
 }
 
 
@@ -12,8 +12,8 @@
 #define TRACK_H_INCLUDED
 
 
-#define __USE_XOPEN
 #include <time.h>
+#include <stdint.h>
 
 
 #ifdef __cplusplus
@@ -24,6 +24,50 @@ typedef void ( * log_hndl ) ( void * env, const char * msg );
 
 typedef struct track_o * track_t;
 
+typedef struct cursor_o * trk_cursor_t;
+
+typedef struct cache_o * trk_cache_t;
+
+/**
+ * Track setup handler of a track cache, called with each new track
+ * before it is loaded, e.g. to set its options.
+ */
+typedef void ( * trk_setup_hndl ) ( void * env, track_t track );
+
+/**
+ * Track cache statistics, see trk_cache_get_stats().
+ */
+struct trk_cache_stats {
+    size_t hits;		/**< Requests served by a loaded track. */
+    size_t misses;		/**< Requests that loaded the file. */
+    size_t waits;		/**< Requests that waited for a load in progress. */
+    size_t evictions;		/**< Tracks evicted to stay within the budget. */
+    size_t entries;		/**< Tracks in the cache. */
+    size_t bytes;		/**< Memory used by tracks in the cache. */
+};
+
+/**
+ * NMEA sentences making up a track point, see trk_set_nmea_sentences().
+ */
+#define TRK_NMEA_RMC      0x01
+#define TRK_NMEA_GGA      0x02
+#define TRK_NMEA_GSA      0x04
+#define TRK_NMEA_DEFAULT  ( TRK_NMEA_RMC | TRK_NMEA_GGA | TRK_NMEA_GSA )
+
+
+/**
+ * Initialize library globals.
+ *
+ * Called by trk_make() and trk_cache_make(), so there is no need to call
+ * it; only the first call does anything. After that the library is
+ * reentrant: different tracks may be made, loaded and queried in
+ * parallel, and a loaded track may be queried from several threads at
+ * once. A track must not be queried while it is being loaded or its
+ * options changed, except for appends to a live track (see
+ * trk_set_live()), and a cursor belongs to one thread at a time. Error
+ * and output handlers are called from the thread that caused them.
+ */
+void trk_global_init( void );
 
 /**
  * Make track object.
@@ -64,6 +108,199 @@ int trk_from_file( track_t track, const char * file );
  */
 int trk_from_buffer( track_t track, void * buffer, size_t size );
 
+/**
+ * Cache parsed track files.
+ *
+ * trk_from_file() then keeps a snapshot of each file it loads into an
+ * empty track, keyed by the file path, size, modification time and
+ * content checksum and by the point encoding and NMEA sentences set,
+ * and maps it instead of parsing the file while the key matches. Stale
+ * or damaged entries are detected and replaced. In a cache directory,
+ * loads with different options have separate entries. Failures to
+ * write the cache are not reported.
+ *
+ * @param  track  Track object.
+ * @param  dir    Cache directory, "" to keep each snapshot next to its
+ *                file (with a ".trks" suffix), NULL to disable (the
+ *                default).
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_set_cache_dir( track_t track, const char * dir );
+
+/**
+ * Reserve storage for track points.
+ *
+ * Loading appends points to the track; reserving the expected total
+ * number of points up front avoids intermediate reallocations.
+ *
+ * @param  track  Track object.
+ * @param  n      Total number of points to reserve storage for.
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_reserve( track_t track, size_t n );
+
+/**
+ * Set the number of threads used to load NMEA data.
+ *
+ * Large NMEA inputs are split at line boundaries and the parts are
+ * parsed in parallel; the result is the same as a sequential load.
+ *
+ * @param  track    Track object.
+ * @param  nthreads Number of threads, 0 for the number of online
+ *                  processors. Default is 1.
+ */
+void trk_set_nmea_threads( track_t track, unsigned nthreads );
+
+/**
+ * Set the NMEA sentences a track point is made of.
+ *
+ * A point is added once every sentence of the set has been seen since
+ * the previous one; other sentences are skipped without being checked
+ * or parsed. RMC, which carries time and position, is always included.
+ * Values of sentences left out are not set (NaN, or -1 for satellites
+ * and fix type).
+ *
+ * @param  track     Track object.
+ * @param  sentences TRK_NMEA_* flags. Default is TRK_NMEA_DEFAULT.
+ */
+void trk_set_nmea_sentences( track_t track, unsigned sentences );
+
+/**
+ * Feed a chunk of a live NMEA stream.
+ *
+ * Chunks may be cut anywhere, also within a sentence: the unterminated
+ * last line and the epoch state are kept for the next call, and each
+ * epoch is appended with trk_append_point() once its line end arrives.
+ * The work done is proportional to the chunk. Epochs not after the end
+ * of the track and fixes without position are dropped. Sentences set
+ * with trk_set_nmea_sentences() apply from the first call on.
+ *
+ * @param  track  Track object, possibly live.
+ * @param  bytes  Stream bytes.
+ * @param  n      Number of bytes.
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_nmea_feed( track_t track, const void * bytes, size_t n );
+
+/**
+ * Store track points in the compact fixed-point encoding.
+ *
+ * Points take about 25 bytes instead of about 110: times are rounded
+ * to milliseconds, coordinates to 1e-7 degree, altitude to 1 cm, speed
+ * to 1 cm/s (up to 655.34 m/s), azimuth to 0.01 degree and DOP to 0.1
+ * (up to 25.4); larger speeds and DOPs are clamped to the top of their
+ * range. Segments between points are computed on each query instead of
+ * being cached. All points must lie within 24 days of the first one.
+ * Must be set before any point is loaded.
+ *
+ * @param  track    Track object.
+ * @param  compact  1 for the compact encoding, 0 for the default one.
+ * @retval 1        Success.
+ * @retval 0        Points are already loaded or the track is live.
+ */
+int trk_set_compact( track_t track, int compact );
+
+/**
+ * Save track points to a binary snapshot file.
+ *
+ * The snapshot holds the loaded points and their segment cache in
+ * native byte order; it is written to a temporary file that is then
+ * renamed over path. A live track may be saved while its writer
+ * appends; the snapshot holds the points appended up to some moment.
+ *
+ * @param  track  Track object.
+ * @param  path   Snapshot file path.
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_save_snapshot( track_t track, const char * path );
+
+/**
+ * Load track points from a snapshot file written by trk_save_snapshot().
+ *
+ * The file is mapped and, when the track has no points yet and the same
+ * point encoding, queried in place without parsing. The header and
+ * column layout are checked; point data is trusted, see
+ * trk_verify_snapshot().
+ *
+ * @param  track  Track object.
+ * @param  path   Snapshot file path.
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_from_snapshot( track_t track, const char * path );
+
+/**
+ * Check a snapshot file without loading it.
+ *
+ * Besides the header and column layout checked on every load, the
+ * point data is checked against the checksum written with it. Reading
+ * all the data, this costs about as much as copying the file; do it
+ * before trk_from_snapshot() for files that may have been damaged.
+ *
+ * @param  track  Track object, for error reporting.
+ * @param  path   Snapshot file path.
+ * @retval 1      The snapshot is intact.
+ * @retval 0      Failure or damaged snapshot.
+ */
+int trk_verify_snapshot( track_t track, const char * path );
+
+/**
+ * Make a track live or end its live mode.
+ *
+ * A live track has one writer thread adding points with
+ * trk_append_point() while any number of threads query it. Queries
+ * never block and see the points appended up to some moment; the
+ * writer only waits for queries in progress when the point storage
+ * grows, which trk_reserve() can do up front. Other changes, such as
+ * loading files or snapshots, fail on a live track. Live mode must be
+ * set and ended while no query runs.
+ *
+ * @param  track  Track object, loaded or not.
+ * @param  live   1 to make the track live, 0 to end live mode.
+ * @retval 1      Success.
+ * @retval 0      Failure.
+ */
+int trk_set_live( track_t track, int live );
+
+/**
+ * Append a point after the end of a track.
+ *
+ * Points must come in time order and have a position; values not known
+ * are NaN, or -1 for satellites and fix type. Usable on any track, but
+ * meant for live ones, see trk_set_live().
+ *
+ * @param  track      Track object.
+ * @param  time       Nanoseconds since the Epoch, after the last point.
+ * @param  latitude   Latitude.
+ * @param  longitude  Longitude.
+ * @param  altitude   Altitude, meters.
+ * @param  azimuth    Azimuth, degrees.
+ * @param  speed      Speed, m/s.
+ * @param  nsat       Number of satellites.
+ * @param  fix_type   Fix type.
+ * @param  hdop       Horizontal dilution of precision.
+ * @param  vdop       Vertical dilution of precision.
+ * @param  pdop       Position dilution of precision.
+ * @retval 1          Success.
+ * @retval 0          Failure.
+ */
+int trk_append_point( track_t track,
+		      int64_t time,
+		      double  latitude,
+		      double  longitude,
+		      double  altitude,
+		      double  azimuth,
+		      double  speed,
+		      int     nsat,
+		      int     fix_type,
+		      double  hdop,
+		      double  vdop,
+		      double  pdop );
+
 /**
  * Get coordinates at given time.
  *
@@ -85,11 +322,84 @@ int trk_get_coord_by_utime( track_t  track,
 			    double * azimuth,
 			    double * speed );
 
+/**
+ * Get coordinates at given time with nanosecond resolution.
+ *
+ * @param  track      Track object.
+ * @param  time       Nanoseconds since the Epoch.
+ * @param  latitude   Placeholder for latitude.
+ * @param  longitude  Placeholder for longitude.
+ * @param  altitude   Placeholder for altitude.
+ * @param  azimuth    Placeholder for azimuth.
+ * @param  speed      Placeholder for speed.
+ * @retval 1          Success.
+ * @retval 0          Failure.
+ */
+int trk_get_coord_by_utime_ns( track_t  track,
+			       int64_t  time,
+			       double * latitude,
+			       double * longitude,
+			       double * altitude,
+			       double * azimuth,
+			       double * speed );
+
+/**
+ * Get coordinates at given times.
+ *
+ * Times are expected in ascending order: the track and the times are
+ * walked together in a single pass. Output arrays hold n elements each
+ * and may be NULL; entries for times out of track range are set to NaN.
+ *
+ * @param  track       Track object.
+ * @param  times       Unixtimes.
+ * @param  n           Number of times.
+ * @param  latitudes   Placeholder for latitudes.
+ * @param  longitudes  Placeholder for longitudes.
+ * @param  altitudes   Placeholder for altitudes.
+ * @param  azimuths    Placeholder for azimuths.
+ * @param  speeds      Placeholder for speeds.
+ * @retval 1           Success.
+ * @retval 0           Some times are out of track range.
+ */
+int trk_get_coords_by_utimes( track_t        track,
+			      const time_t * times,
+			      size_t         n,
+			      double       * latitudes,
+			      double       * longitudes,
+			      double       * altitudes,
+			      double       * azimuths,
+			      double       * speeds );
+
+/**
+ * Get coordinates at given times with nanosecond resolution.
+ *
+ * Same as trk_get_coords_by_utimes(), times are nanoseconds since the Epoch.
+ *
+ * @param  track       Track object.
+ * @param  times       Nanosecond times.
+ * @param  n           Number of times.
+ * @param  latitudes   Placeholder for latitudes.
+ * @param  longitudes  Placeholder for longitudes.
+ * @param  altitudes   Placeholder for altitudes.
+ * @param  azimuths    Placeholder for azimuths.
+ * @param  speeds      Placeholder for speeds.
+ * @retval 1           Success.
+ * @retval 0           Some times are out of track range.
+ */
+int trk_get_coords_by_utimes_ns( track_t         track,
+				 const int64_t * times,
+				 size_t          n,
+				 double        * latitudes,
+				 double        * longitudes,
+				 double        * altitudes,
+				 double        * azimuths,
+				 double        * speeds );
+
 /**
  * Get coordinates at given time.
  *
  * @param  track      Track object.
- * @param  date       ISO 8601 UTC datetime.
+ * @param  date       ISO 8601 UTC datetime, fraction of a second allowed.
  * @param  latitude   Placeholder for latitude.
  * @param  longitude  Placeholder for longitude.
  * @param  altitude   Placeholder for altitude.
@@ -106,6 +416,67 @@ int trk_get_coord_by_ISOdate( track_t      track,
 			      double     * azimuth,
 			      double     * speed );
 
+/**
+ * Make query cursor.
+ *
+ * A cursor remembers the track segment of its last query, so a stream
+ * of close or increasing times is resolved in constant time per query.
+ * The cursor must not outlive its track or be used across track loads.
+ *
+ * @param  track  Track object.
+ * @return        New cursor object or NULL.
+ */
+trk_cursor_t trk_cursor_make( track_t track );
+
+/**
+ * Drop query cursor.
+ *
+ * @param  cursor  Cursor object.
+ */
+void trk_cursor_drop( trk_cursor_t cursor );
+
+/**
+ * Get coordinates at given time using cursor.
+ *
+ * @param  cursor     Cursor object.
+ * @param  time       Unixtime.
+ * @param  latitude   Placeholder for latitude.
+ * @param  longitude  Placeholder for longitude.
+ * @param  altitude   Placeholder for altitude.
+ * @param  azimuth    Placeholder for azimuth.
+ * @param  speed      Placeholder for speed.
+ * @retval 1          Success.
+ * @retval 0          Failure.
+ */
+int trk_cursor_get_coord_by_utime( trk_cursor_t   cursor,
+				   time_t         time,
+				   double       * latitude,
+				   double       * longitude,
+				   double       * altitude,
+				   double       * azimuth,
+				   double       * speed );
+
+/**
+ * Get coordinates at given time with nanosecond resolution using cursor.
+ *
+ * @param  cursor     Cursor object.
+ * @param  time       Nanoseconds since the Epoch.
+ * @param  latitude   Placeholder for latitude.
+ * @param  longitude  Placeholder for longitude.
+ * @param  altitude   Placeholder for altitude.
+ * @param  azimuth    Placeholder for azimuth.
+ * @param  speed      Placeholder for speed.
+ * @retval 1          Success.
+ * @retval 0          Failure.
+ */
+int trk_cursor_get_coord_by_utime_ns( trk_cursor_t   cursor,
+				      int64_t        time,
+				      double       * latitude,
+				      double       * longitude,
+				      double       * altitude,
+				      double       * azimuth,
+				      double       * speed );
+
 /**
  * Get track summary information.
  *
@@ -140,6 +511,63 @@ int trk_get_track_summary( track_t  track,
  */
 int trk_dump_track( track_t track );
 
+/**
+ * Make track cache.
+ *
+ * The cache maps track files, identified by device and inode, to shared
+ * tracks loaded with trk_from_file(). It keeps the most recently used
+ * tracks within the memory budget; tracks in use are never evicted. All
+ * functions may be called from several threads.
+ *
+ * @param  err_hndl  Error handler, also given to the cached tracks.
+ * @param  setup     Track setup handler or NULL.
+ * @param  env       Handlers environment.
+ * @param  budget    Memory budget in bytes.
+ * @return           New track cache object or NULL.
+ */
+trk_cache_t trk_cache_make( log_hndl         err_hndl,
+			    trk_setup_hndl   setup,
+			    void           * env,
+			    size_t           budget );
+
+/**
+ * Drop track cache. All tracks must have been released.
+ *
+ * @param  cache  Track cache object.
+ */
+void trk_cache_drop( trk_cache_t cache );
+
+/**
+ * Get a track of a file from the cache, loading it if needed.
+ *
+ * A file that changed size or modification time since it was loaded
+ * is loaded again. Concurrent requests for a file being loaded wait
+ * for that load; failed loads are not kept, the next request tries
+ * again. The track is shared and must only be queried, and
+ * released with trk_cache_release() instead of being dropped.
+ *
+ * @param  cache  Track cache object.
+ * @param  file   Track file path.
+ * @return        Track object or NULL.
+ */
+track_t trk_cache_get( trk_cache_t cache, const char * file );
+
+/**
+ * Release a track got from the cache.
+ *
+ * @param  cache  Track cache object.
+ * @param  track  Track object.
+ */
+void trk_cache_release( trk_cache_t cache, track_t track );
+
+/**
+ * Get track cache statistics.
+ *
+ * @param  cache  Track cache object.
+ * @param  stats  Placeholder for statistics.
+ */
+void trk_cache_get_stats( trk_cache_t cache, struct trk_cache_stats * stats );
+
 
 #ifdef __cplusplus
 } /* extern "C" */
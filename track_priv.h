@@ -8,16 +8,57 @@
 #define TRACK_PRIV_H_INCLUDED
 
 
+#include <stdint.h>
 #include <time.h>
 
 #include "track.h"
+#include "point.h"
 
 
 #define TU_EXPORT __attribute__ ((visibility("default")))
 
+#define TRK_NSEC_PER_SEC 1000000000LL
+
+
+/*
+ * Whole seconds of a nanosecond time, rounded towards minus infinity.
+ */
+static inline time_t trk_floor_sec( int64_t time )
+{
+    return ( time_t )( time >= 0 ? time / TRK_NSEC_PER_SEC :
+		       -( ( -time + TRK_NSEC_PER_SEC - 1 ) / TRK_NSEC_PER_SEC ) );
+}
+
+int trk_parse_isotime( const char * str, size_t len, int64_t * time );
+
+
+void trk_error( track_t track, const char * fmt, ... )
+    __attribute__ ((format(printf, 2, 3)));
+
+size_t trk_get_npoints( track_t track );
+
+struct points_o * trk_get_points( track_t track );
+
+unsigned trk_get_nmea_threads( track_t track );
+
+unsigned trk_get_nmea_sentences( track_t track );
+
+void trk_truncate( track_t track, size_t npoints );
+
+size_t trk_get_memory( track_t track );
+
+struct nmea_feed * trk_get_nmea_feed( track_t track );
+
+void trk_set_nmea_feed( track_t track, struct nmea_feed * feed );
+
+void trk_set_cache_entry( track_t track, void * entry );
+
+void * trk_get_cache_entry( track_t track );
+
+int trk_finalize( track_t track );
 
 int trk_add_point( track_t track,
-		   time_t  time,
+		   int64_t time,
 		   double  latitude,
 		   double  longitude,
 		   double  altitude,
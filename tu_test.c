@@ -4,23 +4,116 @@
  *
  */
 
+/* strptime(), tm_gmtoff */
+#define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
 
 #include "track.h"
 
 
+struct query {
+    double  latitude, longitude, altitude, azimuth, speed;
+    size_t  npoints;
+    double  distance;
+    int     ret;
+};
+
+struct check {
+    pthread_t     thread;
+    track_t       shared;
+    struct query  own;
+    struct query  queried;
+};
+
+struct live_check {
+    pthread_t     thread;
+    track_t       track;
+    atomic_int  * done;
+    unsigned      seed;
+    size_t        seen;
+    size_t        queries;
+    int           ok;
+};
+
+struct cache_check {
+    pthread_t     thread;
+    trk_cache_t   cache;
+    char       ** files;
+    unsigned      seed;
+    struct query  ref;
+    size_t        requests;
+    int           ok;
+};
+
+/* files the cache check requests: the track file and copies of it */
+#define CACHE_FILES   4
+#define CACHE_ROUNDS  200
+
+/* points appended by the live check, 100 ms apart from 2020-05-17T10:00:00Z */
+#define LIVE_START  1589709600000000000LL
+#define LIVE_STEP   100000000LL
+
+
 static int parse_cmdline( int argc, char **argv );
 static void err_hndl( void * env, const char * msg );
 static void out_hndl( void * env, const char * msg );
 
-static char * s2dhms( time_t s );
+static char * s2dhms( time_t s, char * buf, size_t size );
+
+static int feed_track( track_t track, const char * file, size_t chunk );
+
+static int check_batch( track_t track, time_t start, time_t end );
+static int same_value( double a, double b );
+
+static int check_cursor( track_t track, time_t start, time_t end );
+
+static int bench_isotime( track_t track, time_t start, time_t end, int rounds );
+static int parse_isotime_libc( const char * str, int64_t * time );
+static double elapsed_ns( const struct timespec * t0 );
+
+static int check_parallel( track_t track, int nthreads );
+static void * check_thread( void * arg );
+static int query_track( track_t track, struct query * q );
+
+static int check_cache( track_t track, int nthreads, size_t budget );
+static void * cache_thread( void * arg );
+static void cache_setup( void * env, track_t track );
+static int copy_file( const char * from, const char * to );
+
+static int check_live( int nthreads, size_t npoints );
+static void * live_thread( void * arg );
+static int query_live_point( track_t track, size_t i, int mid, int * same );
+static double live_latitude( size_t i );
+static double live_longitude( size_t i );
+static double live_altitude( size_t i );
 
 
 static char * opt_track_file  = NULL;
 static char * opt_date_time   = NULL;
 static int    opt_debug       = 0;
+static int    opt_threads     = 1;
+static int    opt_compact     = 0;
+static int    opt_snapshot    = 0;
+static int    opt_verify      = 0;
+static char * opt_save_file   = NULL;
+static char * opt_cache_dir   = NULL;
+static int    opt_parallel    = 0;
+static int    opt_feed        = 0;
+static int    opt_batch       = 0;
+static int    opt_cursor      = 0;
+static int    opt_bench       = 0;
+static int    opt_live        = 0;
+static long   opt_budget      = -1;
 
 
 
@@ -40,7 +133,23 @@ int main( int argc, char **argv )
     if( !track )
 	return 1;
 
-    if( !trk_from_file( track, opt_track_file ) ) {
+    trk_set_nmea_threads( track, opt_threads );
+    trk_set_compact( track, opt_compact );
+    trk_set_cache_dir( track, opt_cache_dir );
+
+    if( opt_feed )
+	ret = feed_track( track, opt_track_file, opt_feed );
+    else if( opt_snapshot )
+	ret = ( !opt_verify || trk_verify_snapshot( track, opt_track_file ) ) &&
+	    trk_from_snapshot( track, opt_track_file );
+    else
+	ret = trk_from_file( track, opt_track_file );
+    if( !ret ) {
+	trk_drop( track );
+	return 1;
+    }
+
+    if( opt_save_file && !trk_save_snapshot( track, opt_save_file ) ) {
 	trk_drop( track );
 	return 1;
     }
@@ -58,13 +167,12 @@ int main( int argc, char **argv )
 				 &distance, &min_speed, &max_speed,
 				 &min_altitude, &max_altitude );
     if( ret ) {
-	struct tm *tm;
+	struct tm tm;
 	char tmbuf[2][64];
+	char dhms[32];
 
-	tm = localtime( &start );
-	strftime( tmbuf[0], sizeof( tmbuf[0] ), "%FT%TZ", tm );
-	tm = localtime( &end );
-	strftime( tmbuf[1], sizeof( tmbuf[1] ), "%FT%TZ", tm );
+	strftime( tmbuf[0], sizeof( tmbuf[0] ), "%FT%TZ", gmtime_r( &start, &tm ) );
+	strftime( tmbuf[1], sizeof( tmbuf[1] ), "%FT%TZ", gmtime_r( &end, &tm ) );
 
 	fprintf( stdout, "track summary:\n"	\
 		 "  num points:    %u\n"	\
@@ -77,13 +185,31 @@ int main( int argc, char **argv )
 		 "  max speed:     %lf kph\n"	\
 		 "  min altitude:  %lf m\n"	\
 		 "  max altitude:  %lf m\n",
-		 npoints, tmbuf[0], tmbuf[1], s2dhms( end - start ), distance,
+		 npoints, tmbuf[0], tmbuf[1], s2dhms( end - start, dhms, sizeof( dhms ) ), distance,
 		 min_speed * 3.6, distance * 3.6 / ( end - start ), max_speed * 3.6,
 		 min_altitude, max_altitude );
     }
 
     opt_debug && trk_dump_track( track );
 
+    if( ret && opt_batch )
+	ret = check_batch( track, start, end );
+
+    if( ret && opt_cursor )
+	ret = check_cursor( track, start, end );
+
+    if( ret && opt_parallel )
+	ret = check_parallel( track, opt_parallel );
+
+    if( ret && opt_budget >= 0 )
+	ret = check_cache( track, opt_parallel ? opt_parallel : 1, opt_budget );
+
+    if( ret && opt_live )
+	ret = check_live( opt_parallel ? opt_parallel : 1, opt_live );
+
+    if( ret && opt_bench )
+	ret = bench_isotime( track, start, end, opt_bench );
+
     trk_drop( track );
 
     return ret ? 0 : 1;
@@ -105,7 +231,7 @@ static void out_hndl( void * env, const char * msg )
 }
 
 
-static char * s2dhms( time_t s )
+static char * s2dhms( time_t s, char * buf, size_t size )
 {
     int secInMin = 60;
     int secInHour = 60 * secInMin;
@@ -116,14 +242,705 @@ static char * s2dhms( time_t s )
     int mS = hS % secInHour;
     int M = mS / secInMin;
     int S = mS % secInMin;
-    static char buf[32];
 
-    snprintf( buf, sizeof( buf ), "%02d %02d:%02d:%02d", D, H, M, S );
+    snprintf( buf, size, "%02d %02d:%02d:%02d", D, H, M, S );
 
     return buf;
 }
 
 
+/*
+ * Feed an NMEA file in chunks of the given size, as a live receiver would.
+ */
+static int feed_track( track_t track, const char * file, size_t chunk )
+{
+    char *buf;
+    ssize_t n;
+    int fd, ret = 1;
+
+    fd = open( file, O_RDONLY );
+    if( fd == -1 ) {
+	perror( file );
+	return 0;
+    }
+
+    buf = malloc( chunk );
+    if( !buf ) {
+	close( fd );
+	return 0;
+    }
+
+    while( ret && ( n = read( fd, buf, chunk ) ) > 0 )
+	ret = trk_nmea_feed( track, buf, n );
+
+    free( buf );
+    close( fd );
+
+    return ret;
+}
+
+/*
+ * Query times going back and forth, some out of the track range, in
+ * one batch and check each entry matches a single query: times out of
+ * range must not move the batch position.
+ */
+static int check_batch( track_t track, time_t start, time_t end )
+{
+    static const double fractions[] = {
+	.75, -1., .25, 2., .6, .1, -1., .55, 2., .15, .9
+    };
+    enum { N = sizeof( fractions ) / sizeof( *fractions ) };
+    int64_t times[N], first, last;
+    double lat[N], lon[N], alt[N], az[N], spd[N];
+    double la, lo, al, a, sp;
+    int i, ok = 1;
+
+    /* whole seconds within the range; -1 and 2 are before and after it */
+    first = ( int64_t )start + 1;
+    last  = ( int64_t )end;
+    for( i = 0; i < N; i++ ) {
+	if( fractions[i] < 0. )
+	    times[i] = ( first - 2 ) * 1000000000LL;
+	else if( fractions[i] > 1. )
+	    times[i] = ( last + 2 ) * 1000000000LL;
+	else
+	    times[i] = ( first + ( int64_t )( ( last - first ) * fractions[i] ) ) * 1000000000LL;
+    }
+
+    if( trk_get_coords_by_utimes_ns( track, times, N, lat, lon, alt, az, spd ) ) {
+	fprintf( stderr, "batch check: out of range times not reported\n" );
+	ok = 0;
+    }
+
+    for( i = 0; i < N; i++ ) {
+	if( !trk_get_coord_by_utime_ns( track, times[i], &la, &lo, &al, &a, &sp ) )
+	    la = lo = al = a = sp = NAN;
+
+	if( !same_value( lat[i], la ) || !same_value( lon[i], lo ) ||
+	    !same_value( alt[i], al ) || !same_value( az[i], a ) ||
+	    !same_value( spd[i], sp ) ) {
+	    fprintf( stderr, "batch check: time %d differs: %lf, %lf instead of %lf, %lf\n",
+		     i, lat[i], lon[i], la, lo );
+	    ok = 0;
+	}
+    }
+
+    if( ok )
+	fprintf( stdout, "batch check: %d times ok\n", N );
+
+    return ok;
+}
+
+static int same_value( double a, double b )
+{
+    return a == b || ( isnan( a ) && isnan( b ) );
+}
+
+/*
+ * Query a mostly increasing stream of times through a cursor and check
+ * each result matches a single query. Half second steps hit the point
+ * times of tracks recorded every second and the segments between them;
+ * short steps back and jumps anywhere make the cursor search.
+ */
+static int check_cursor( track_t track, time_t start, time_t end )
+{
+    enum { N = 20000 };
+    trk_cursor_t cursor;
+    int64_t first, last, time;
+    double lat, lon, alt, az, spd;
+    double la, lo, al, a, sp;
+    unsigned seed = 1;
+    int i, ret, ok = 1;
+
+    cursor = trk_cursor_make( track );
+    if( !cursor )
+	return 0;
+
+    /* whole seconds within the range */
+    first = ( int64_t )start + 1;
+    last  = ( int64_t )end;
+    if( last < first ) {
+	trk_cursor_drop( cursor );
+	fprintf( stderr, "cursor check: track too short\n" );
+	return 0;
+    }
+
+    time = first * 1000000000LL;
+    for( i = 0; ok && i < N; i++ ) {
+	if( i % 64 == 63 )
+	    time = ( first + rand_r( &seed ) % ( last - first + 1 ) ) * 1000000000LL;
+	else if( i % 16 == 15 )
+	    time -= ( rand_r( &seed ) % 8 ) * 500000000LL;
+	else
+	    time += 500000000LL;
+
+	if( time < first * 1000000000LL || time > last * 1000000000LL )
+	    time = first * 1000000000LL;
+
+	ret = trk_cursor_get_coord_by_utime_ns( cursor, time, &lat, &lon, &alt, &az, &spd );
+	if( !ret )
+	    lat = lon = alt = az = spd = NAN;
+	if( !trk_get_coord_by_utime_ns( track, time, &la, &lo, &al, &a, &sp ) )
+	    la = lo = al = a = sp = NAN;
+
+	if( !same_value( lat, la ) || !same_value( lon, lo ) ||
+	    !same_value( alt, al ) || !same_value( az, a ) ||
+	    !same_value( spd, sp ) ) {
+	    fprintf( stderr, "cursor check: query %d differs: %lf, %lf instead of %lf, %lf\n",
+		     i, lat, lon, la, lo );
+	    ok = 0;
+	}
+    }
+
+    trk_cursor_drop( cursor );
+
+    if( ok )
+	fprintf( stdout, "cursor check: %d times ok\n", N );
+
+    return ok;
+}
+
+/*
+ * Time queries by ISO 8601 date against the strptime() and mktime()
+ * parsing they used before, over dates spread across the track. The
+ * same queries by Unixtime give the cost of the lookup alone. The three
+ * run in turn in every round and the fastest round of each counts.
+ */
+static int bench_isotime( track_t track, time_t start, time_t end, int rounds )
+{
+    enum { N = 1000, BY_UTIME, BY_LIBC, BY_ISO };
+    static char dates[N][32];
+    int64_t times[N], time;
+    struct timespec t0;
+    struct tm tm;
+    double la, lo, al, a, sp, ns, best[3] = { INFINITY, INFINITY, INFINITY };
+    time_t t;
+    int i, r, pass;
+
+    for( i = 0; i < N; i++ ) {
+	t = start + ( end - start ) * i / N;
+	strftime( dates[i], sizeof( dates[i] ), "%FT%T", gmtime_r( &t, &tm ) );
+	snprintf( dates[i] + strlen( dates[i] ), sizeof( dates[i] ) - strlen( dates[i] ),
+		  ".%03dZ", i );
+	times[i] = ( int64_t )t * 1000000000LL + i * 1000000LL;
+    }
+
+    for( r = 0; r < rounds; r++ ) {
+	for( pass = BY_UTIME; pass <= BY_ISO; pass++ ) {
+	    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+	    for( i = 0; i < N; i++ ) {
+		switch( pass ) {
+		case BY_UTIME:
+		    trk_get_coord_by_utime_ns( track, times[i], &la, &lo, &al, &a, &sp );
+		    break;
+		case BY_LIBC:
+		    if( !parse_isotime_libc( dates[i], &time ) ) {
+			fprintf( stderr, "bench: strptime() failed on '%s'\n", dates[i] );
+			return 0;
+		    }
+		    trk_get_coord_by_utime_ns( track, time, &la, &lo, &al, &a, &sp );
+		    break;
+		case BY_ISO:
+		    trk_get_coord_by_ISOdate( track, dates[i], &la, &lo, &al, &a, &sp );
+		    break;
+		}
+	    }
+
+	    ns = elapsed_ns( &t0 ) / N;
+	    if( ns < best[pass - BY_UTIME] )
+		best[pass - BY_UTIME] = ns;
+	}
+    }
+
+    fprintf( stdout, "bench: %d rounds of %d queries, ns per query:\n"	\
+	     "  by Unixtime:        %8.1lf\n"				\
+	     "  strptime + mktime:  %8.1lf (parse %.1lf)\n"		\
+	     "  by ISO date:        %8.1lf (parse %.1lf)\n",
+	     rounds, N, best[0], best[1], best[1] - best[0],
+	     best[2], best[2] - best[0] );
+
+    return 1;
+}
+
+/*
+ * The date parsing trk_get_coord_by_ISOdate() used to do, taking the
+ * date as local time; the zone offset is added back so both parsers
+ * query the same points.
+ */
+static int parse_isotime_libc( const char * str, int64_t * time )
+{
+    struct tm tm;
+    const char *end;
+    int64_t nsec = 0, scale = 1000000000LL;
+    time_t sec;
+
+    memset( &tm, 0, sizeof( tm ) );
+
+    end = strptime( str, "%FT%T", &tm );
+    if( !end )
+	return 0;
+
+    if( *end == '.' ) {
+	for( end++; *end >= '0' && *end <= '9'; end++ ) {
+	    if( scale > 1 ) {
+		scale /= 10;
+		nsec += ( *end - '0' ) * scale;
+	    }
+	}
+    }
+
+    tm.tm_isdst = -1;
+    sec = mktime( &tm );
+    if( sec == -1 )
+	return 0;
+
+    *time = ( ( int64_t )sec + tm.tm_gmtoff ) * 1000000000LL + nsec;
+
+    return 1;
+}
+
+static double elapsed_ns( const struct timespec * t0 )
+{
+    struct timespec t1;
+
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    return ( t1.tv_sec - t0->tv_sec ) * 1e9 + ( t1.tv_nsec - t0->tv_nsec );
+}
+
+/*
+ * Load the track in several threads while they all query the loaded
+ * one, and check every result matches a single threaded query.
+ */
+static int check_parallel( track_t track, int nthreads )
+{
+    struct check *checks;
+    struct query ref;
+    int i, n, ok = 1;
+
+    if( !query_track( track, &ref ) )
+	return 0;
+
+    checks = calloc( nthreads, sizeof( *checks ) );
+    if( !checks )
+	return 0;
+
+    for( n = 0; n < nthreads; n++ ) {
+	checks[n].shared = track;
+	if( pthread_create( &checks[n].thread, NULL, check_thread, &checks[n] ) ) {
+	    fprintf( stderr, "can not start check thread\n" );
+	    ok = 0;
+	    break;
+	}
+    }
+
+    for( i = 0; i < n; i++ ) {
+	pthread_join( checks[i].thread, NULL );
+	if( memcmp( &checks[i].own, &ref, sizeof( ref ) ) ||
+	    memcmp( &checks[i].queried, &ref, sizeof( ref ) ) ) {
+	    fprintf( stderr, "parallel check: thread %d result differs\n", i );
+	    ok = 0;
+	}
+    }
+
+    free( checks );
+
+    if( ok )
+	fprintf( stdout, "parallel check: %d threads ok\n", nthreads );
+
+    return ok;
+}
+
+static void * check_thread( void * arg )
+{
+    struct check *check = arg;
+    track_t track;
+
+    query_track( check->shared, &check->queried );
+
+    track = trk_make( err_hndl, NULL, NULL );
+    if( !track )
+	return NULL;
+
+    trk_set_nmea_threads( track, opt_threads );
+    trk_set_compact( track, opt_compact );
+
+    if( opt_snapshot ? trk_from_snapshot( track, opt_track_file ) :
+	trk_from_file( track, opt_track_file ) )
+	query_track( track, &check->own );
+
+    trk_drop( track );
+
+    return NULL;
+}
+
+static int query_track( track_t track, struct query * q )
+{
+    time_t start, end;
+    double min_speed, max_speed, min_altitude, max_altitude;
+
+    /* compared with memcmp() */
+    memset( q, 0, sizeof( *q ) );
+
+    q->ret = trk_get_coord_by_ISOdate( track, opt_date_time,
+				       &q->latitude, &q->longitude,
+				       &q->altitude, &q->azimuth,
+				       &q->speed ) &&
+	trk_get_track_summary( track, &q->npoints, &start, &end,
+			       &q->distance, &min_speed, &max_speed,
+			       &min_altitude, &max_altitude );
+
+    return q->ret;
+}
+
+/*
+ * Run threads requesting the track file and copies of it, which are
+ * other cache entries, from one cache with the given memory budget;
+ * every result must match a query of the track loaded first. The statistics
+ * must add up: no load fails, so an entry only leaves by eviction.
+ */
+static int check_cache( track_t track, int nthreads, size_t budget )
+{
+    struct cache_check *checks;
+    struct trk_cache_stats stats;
+    struct query ref;
+    trk_cache_t cache;
+    char dir[] = "/tmp/tu-test.XXXXXX";
+    char *files[CACHE_FILES] = { opt_track_file };
+    size_t i, requests = 0;
+    int n, ok = 1;
+
+    if( opt_snapshot ) {
+	fprintf( stderr, "cache check: the cache does not load snapshots\n" );
+	return 0;
+    }
+
+    if( !query_track( track, &ref ) )
+	return 0;
+
+    if( !mkdtemp( dir ) ) {
+	perror( dir );
+	return 0;
+    }
+
+    for( i = 1; ok && i < CACHE_FILES; i++ ) {
+	files[i] = malloc( sizeof( dir ) + 16 );
+	if( !files[i] ) {
+	    ok = 0;
+	    break;
+	}
+	sprintf( files[i], "%s/%zu", dir, i );
+	ok = copy_file( opt_track_file, files[i] );
+    }
+
+    cache = ok ? trk_cache_make( err_hndl, cache_setup, NULL, budget ) : NULL;
+    checks = cache ? calloc( nthreads, sizeof( *checks ) ) : NULL;
+    ok = checks != NULL;
+
+    for( n = 0; ok && n < nthreads; n++ ) {
+	checks[n].cache = cache;
+	checks[n].files = files;
+	checks[n].seed  = n + 1;
+	checks[n].ref   = ref;
+	if( pthread_create( &checks[n].thread, NULL, cache_thread, &checks[n] ) ) {
+	    fprintf( stderr, "can not start cache check thread\n" );
+	    ok = 0;
+	    break;
+	}
+    }
+
+    for( i = 0; checks && i < ( size_t )n; i++ ) {
+	pthread_join( checks[i].thread, NULL );
+	if( !checks[i].ok ) {
+	    fprintf( stderr, "cache check: thread %zu result differs\n", i );
+	    ok = 0;
+	}
+	requests += checks[i].requests;
+    }
+
+    if( ok ) {
+	trk_cache_get_stats( cache, &stats );
+
+	fprintf( stdout, "cache check: %d threads, %zu requests, budget %zu:\n"	\
+		 "  hits:      %zu\n"						\
+		 "  misses:    %zu\n"						\
+		 "  waits:     %zu\n"						\
+		 "  evictions: %zu\n"						\
+		 "  entries:   %zu\n"						\
+		 "  bytes:     %zu\n",
+		 nthreads, requests, budget, stats.hits, stats.misses, stats.waits,
+		 stats.evictions, stats.entries, stats.bytes );
+
+	if( stats.hits + stats.misses + stats.waits != requests ||
+	    stats.misses - stats.evictions != stats.entries ||
+	    stats.entries > CACHE_FILES || stats.bytes > budget ||
+	    ( stats.entries == 0 ) != ( stats.bytes == 0 ) ) {
+	    fprintf( stderr, "cache check: statistics do not add up\n" );
+	    ok = 0;
+	}
+    }
+
+    free( checks );
+    if( cache )
+	trk_cache_drop( cache );
+
+    for( i = 1; i < CACHE_FILES && files[i]; i++ ) {
+	unlink( files[i] );
+	free( files[i] );
+    }
+    rmdir( dir );
+
+    return ok;
+}
+
+static void * cache_thread( void * arg )
+{
+    struct cache_check *check = arg;
+    struct query q;
+    track_t track;
+    int i;
+
+    check->ok = 1;
+
+    for( i = 0; check->ok && i < CACHE_ROUNDS; i++ ) {
+	track = trk_cache_get( check->cache, check->files[rand_r( &check->seed ) % CACHE_FILES] );
+	if( !track ) {
+	    check->ok = 0;
+	    break;
+	}
+
+	query_track( track, &q );
+	if( memcmp( &q, &check->ref, sizeof( q ) ) )
+	    check->ok = 0;
+
+	trk_cache_release( check->cache, track );
+	check->requests++;
+    }
+
+    return NULL;
+}
+
+static void cache_setup( void * env, track_t track )
+{
+    ( void )env;
+
+    trk_set_nmea_threads( track, opt_threads );
+    trk_set_compact( track, opt_compact );
+}
+
+static int copy_file( const char * from, const char * to )
+{
+    char buf[65536];
+    ssize_t n = 0;
+    int in, out, ok;
+
+    in = open( from, O_RDONLY );
+    if( in == -1 ) {
+	perror( from );
+	return 0;
+    }
+
+    out = open( to, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+    if( out == -1 ) {
+	perror( to );
+	close( in );
+	return 0;
+    }
+
+    while( ( n = read( in, buf, sizeof( buf ) ) ) > 0 )
+	if( write( out, buf, n ) != n )
+	    break;
+
+    ok = n == 0;
+    if( !ok )
+	perror( to );
+
+    close( in );
+    if( close( out ) )
+	ok = 0;
+
+    return ok;
+}
+
+/*
+ * Append points to a live track while threads query it, from empty so
+ * the storage grows several times, and check every result against the
+ * appended values.
+ */
+static int check_live( int nthreads, size_t npoints )
+{
+    struct live_check *checks;
+    atomic_int done = 0;
+    track_t track;
+    size_t i, queries = 0;
+    int n, ok = 1;
+
+    /* readers look for points not appended yet, which is no error */
+    track = trk_make( NULL, NULL, NULL );
+    if( !track )
+	return 0;
+
+    trk_set_compact( track, opt_compact );
+    if( !trk_set_live( track, 1 ) ) {
+	trk_drop( track );
+	return 0;
+    }
+
+    checks = calloc( nthreads, sizeof( *checks ) );
+    if( !checks ) {
+	trk_drop( track );
+	return 0;
+    }
+
+    for( n = 0; n < nthreads; n++ ) {
+	checks[n].track = track;
+	checks[n].done  = &done;
+	checks[n].seed  = n + 1;
+	checks[n].ok    = 1;
+	if( pthread_create( &checks[n].thread, NULL, live_thread, &checks[n] ) ) {
+	    fprintf( stderr, "can not start live check thread\n" );
+	    ok = 0;
+	    break;
+	}
+    }
+
+    for( i = 0; ok && i < npoints; i++ ) {
+	ok = trk_append_point( track, LIVE_START + ( int64_t )i * LIVE_STEP,
+			       live_latitude( i ), live_longitude( i ), live_altitude( i ),
+			       NAN, NAN, -1, -1, NAN, NAN, NAN );
+	if( !ok )
+	    fprintf( stderr, "live check: can not append point %zu\n", i );
+    }
+
+    atomic_store( &done, 1 );
+
+    for( i = 0; i < ( size_t )n; i++ ) {
+	pthread_join( checks[i].thread, NULL );
+	if( !checks[i].ok )
+	    ok = 0;
+	else if( ok && checks[i].seen != npoints ) {
+	    fprintf( stderr, "live check: thread %zu saw %zu points\n",
+		     i, checks[i].seen );
+	    ok = 0;
+	}
+	queries += checks[i].queries;
+    }
+
+    free( checks );
+
+    trk_set_live( track, 0 );
+    trk_drop( track );
+
+    if( ok )
+	fprintf( stdout, "live check: %zu points, %d threads, %zu queries ok\n",
+		 npoints, nthreads, queries );
+
+    return ok;
+}
+
+/*
+ * Look for the next point, then query one of the points found so far,
+ * which must all stay there, at its time or between it and the next.
+ * The last pass, after the writer is done, must find every point.
+ */
+static void * live_thread( void * arg )
+{
+    struct live_check *check = arg;
+    size_t i;
+    int last, same = 1;
+
+    do {
+	last = atomic_load( check->done );
+
+	while( query_live_point( check->track, check->seen, 0, &same ) && same ) {
+	    check->seen++;
+	    check->queries++;
+	}
+	if( !same )
+	    break;
+
+	if( check->seen == 0 )
+	    continue;
+
+	/* every other query near the end, where the writer is */
+	if( rand_r( &check->seed ) & 1 )
+	    i = rand_r( &check->seed ) % check->seen;
+	else
+	    i = check->seen - 1 - rand_r( &check->seed ) % ( check->seen < 64 ? check->seen : 64 );
+
+	if( !query_live_point( check->track, i,
+			       i + 1 < check->seen && ( rand_r( &check->seed ) & 1 ), &same ) ) {
+	    fprintf( stderr, "live check: point %zu of %zu not found\n", i, check->seen );
+	    same = 0;
+	}
+	if( !same )
+	    break;
+
+	check->queries++;
+    } while( !last );
+
+    check->ok = same;
+
+    return NULL;
+}
+
+/*
+ * Query point i, or the middle of its segment to the next one. Returns
+ * whether the point is there; same tells whether the result matches the
+ * appended values.
+ */
+static int query_live_point( track_t track, size_t i, int mid, int * same )
+{
+    double latitude, longitude, altitude, azimuth, speed, alt;
+    int64_t time;
+
+    time = LIVE_START + ( int64_t )i * LIVE_STEP + ( mid ? LIVE_STEP / 2 : 0 );
+
+    *same = 1;
+
+    if( !trk_get_coord_by_utime_ns( track, time, &latitude, &longitude,
+				    &altitude, &azimuth, &speed ) )
+	return 0;
+
+    /* the compact encoding keeps 1e-7 degrees and centimeters */
+    if( mid ) {
+	alt = ( live_altitude( i ) + live_altitude( i + 1 ) ) / 2;
+	if( latitude < live_latitude( i ) - 1e-7 || latitude > live_latitude( i + 1 ) + 1e-7 ||
+	    longitude < live_longitude( i ) - 1e-7 || longitude > live_longitude( i + 1 ) + 1e-7 )
+	    *same = 0;
+    } else {
+	alt = live_altitude( i );
+	if( fabs( latitude - live_latitude( i ) ) > 1e-7 ||
+	    fabs( longitude - live_longitude( i ) ) > 1e-7 )
+	    *same = 0;
+    }
+    if( fabs( altitude - alt ) > 1e-6 )
+	*same = 0;
+
+    if( !*same )
+	fprintf( stderr, "live check: point %zu%s: %lf, %lf, %lf differs\n",
+		 i, mid ? ".5" : "", latitude, longitude, altitude );
+
+    return 1;
+}
+
+static double live_latitude( size_t i )
+{
+    return 55. + i * 1e-6;
+}
+
+static double live_longitude( size_t i )
+{
+    return 37. + i * 1e-6;
+}
+
+static double live_altitude( size_t i )
+{
+    return ( double )( i % 1000 );
+}
+
+
 static const char *usage =
     PACKAGE_NAME " v. " PACKAGE_VERSION "\n"
     "\n"
@@ -132,7 +949,22 @@ static const char *usage =
     "  -h, --help                   - This help\n"
     "\n"
     "  -T <str>, --track=<str>      - track file (GPX, TCX, NMEA)\n"
-    "  -D <str>, --date=<str>       - ISO 8601 UTC datetime\n";
+    "  -D <str>, --date=<str>       - ISO 8601 UTC datetime\n"
+    "  -j <num>, --threads=<num>    - NMEA loading threads, 0 for all CPUs\n"
+    "  -c, --compact                - compact point encoding\n"
+    "  -s, --snapshot               - track file is a snapshot\n"
+    "  -V, --verify                 - verify the snapshot data before loading\n"
+    "  -S <str>, --save=<str>       - save track snapshot\n"
+    "  -C <str>, --cache=<str>      - parse cache directory, \"\" for sidecars\n"
+    "  -P <num>, --parallel=<num>   - check loading and queries in <num> threads\n"
+    "  -F <num>, --feed=<num>       - feed NMEA track file in <num> byte chunks\n"
+    "  -b, --batch                  - check batch queries against single ones\n"
+    "  -k, --cursor                 - check cursor queries against single ones\n"
+    "  -B <num>, --bench=<num>      - time <num> rounds of date parsing queries\n"
+    "  -L <num>, --budget=<num>     - check the -P threads (or one) sharing a track\n"
+    "                                 cache of <num> bytes\n"
+    "  -A <num>, --append=<num>     - append <num> points to a live track while\n"
+    "                                 the -P threads (or one) query it\n";
 
 static int parse_cmdline( int argc, char **argv )
 {
@@ -141,9 +973,22 @@ static int parse_cmdline( int argc, char **argv )
         { "debug",      no_argument,        0,  'd' },
         { "track",      required_argument,  0,  'T' },
         { "date",       required_argument,  0,  'D' },
+        { "threads",    required_argument,  0,  'j' },
+        { "compact",    no_argument,        0,  'c' },
+        { "snapshot",   no_argument,        0,  's' },
+        { "verify",     no_argument,        0,  'V' },
+        { "save",       required_argument,  0,  'S' },
+        { "cache",      required_argument,  0,  'C' },
+        { "parallel",   required_argument,  0,  'P' },
+        { "feed",       required_argument,  0,  'F' },
+        { "batch",      no_argument,        0,  'b' },
+        { "cursor",     no_argument,        0,  'k' },
+        { "bench",      required_argument,  0,  'B' },
+        { "budget",     required_argument,  0,  'L' },
+        { "append",     required_argument,  0,  'A' },
         { 0,            0,                  0,   0  }
     };
-    const char *short_options = "hdT:D:";
+    const char *short_options = "hdT:D:j:csVS:C:P:F:bkB:L:A:";
     int opt = 0, option_index = 0;
     int help = 0, err = 0;
 
@@ -166,6 +1011,57 @@ static int parse_cmdline( int argc, char **argv )
         case 'D':
             opt_date_time = optarg;
             break;
+        case 'j':
+            opt_threads = atoi( optarg );
+            if( opt_threads < 0 )
+                err = 1;
+            break;
+        case 'c':
+            opt_compact = 1;
+            break;
+        case 's':
+            opt_snapshot = 1;
+            break;
+        case 'V':
+            opt_verify = 1;
+            break;
+        case 'S':
+            opt_save_file = optarg;
+            break;
+        case 'C':
+            opt_cache_dir = optarg;
+            break;
+        case 'P':
+            opt_parallel = atoi( optarg );
+            if( opt_parallel < 0 )
+                err = 1;
+            break;
+        case 'F':
+            opt_feed = atoi( optarg );
+            if( opt_feed < 0 )
+                err = 1;
+            break;
+        case 'b':
+            opt_batch = 1;
+            break;
+        case 'k':
+            opt_cursor = 1;
+            break;
+        case 'B':
+            opt_bench = atoi( optarg );
+            if( opt_bench < 0 )
+                err = 1;
+            break;
+        case 'L':
+            opt_budget = atol( optarg );
+            if( opt_budget < 0 )
+                err = 1;
+            break;
+        case 'A':
+            opt_live = atoi( optarg );
+            if( opt_live < 0 )
+                err = 1;
+            break;
         default:
             err = 1;
 	    break;